@@ -8,16 +8,39 @@
 
 
 Abacus::Abacus(int max_depth, int bucket_idx_len, int fgpt_size, 
-        int fgpt_per_bucket, int seg_idx_base, bool dif_hash) :
+        int fgpt_per_bucket, int seg_idx_base, bool dif_hash, 
+        bool hash_once, HashPolicy hash_policy) :
             _seg_idx_base(seg_idx_base),
             _bucket_idx_len(bucket_idx_len),
             _fgpt_size(fgpt_size),
             _fgpt_per_bucket(fgpt_per_bucket),
-            _dif_hash(dif_hash)
+            _dif_hash(dif_hash),
+            _hash_once(hash_once),
+            _hash_policy(hash_policy)
 {
     _depth = 0;
     _seed = rand();
     _alt_seed = rand();
+    _rng.seed((u64) _seed << 32 | _alt_seed);
+    add_layer();
+}
+
+
+Abacus::Abacus(int max_depth, int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base, bool dif_hash, 
+        u32 seed, u32 alt_seed, bool hash_once, HashPolicy hash_policy) :
+            _seg_idx_base(seg_idx_base),
+            _bucket_idx_len(bucket_idx_len),
+            _fgpt_size(fgpt_size),
+            _fgpt_per_bucket(fgpt_per_bucket),
+            _dif_hash(dif_hash),
+            _hash_once(hash_once),
+            _hash_policy(hash_policy),
+            _seed(seed),
+            _alt_seed(alt_seed),
+            _rng((u64) seed << 32 | alt_seed)
+{
+    _depth = 0;
     add_layer();
 }
 
@@ -31,7 +54,10 @@ Abacus::~Abacus()
 }
 
 
-int Abacus::count(int elt) 
+/* The key API is templated over the key type; the public overloads below
+ * forward to it. *Key* is anything BambooBase::count accepts */
+template <typename Key>
+int Abacus::_count(Key elt) 
 {
     u32 count = 0;
     u32 layer_count;
@@ -50,7 +76,8 @@ int Abacus::count(int elt)
 }
 
 
-void Abacus::increment(int elt) 
+template <typename Key>
+void Abacus::_increment(Key elt) 
 {
     /* Do naive implementation and then optimize later */
     int count;
@@ -71,7 +98,8 @@ void Abacus::increment(int elt)
 }
 
 
-void Abacus::decrement(int elt)
+template <typename Key>
+void Abacus::_decrement(Key elt)
 {
     /* Do naive implementation and then optimize later */
     for (int i = 0; i < _depth; i++) {
@@ -91,6 +119,22 @@ void Abacus::decrement(int elt)
 }
 
 
+int Abacus::count(int elt) { return _count(elt); }
+int Abacus::count(u64 key) { return _count(key); }
+int Abacus::count(std::string_view key) { return _count(key); }
+int Abacus::count_hash(u64 hash) { return _count(HashedKey{hash}); }
+
+void Abacus::increment(int elt) { _increment(elt); }
+void Abacus::increment(u64 key) { _increment(key); }
+void Abacus::increment(std::string_view key) { _increment(key); }
+void Abacus::increment_hash(u64 hash) { _increment(HashedKey{hash}); }
+
+void Abacus::decrement(int elt) { _decrement(elt); }
+void Abacus::decrement(u64 key) { _decrement(key); }
+void Abacus::decrement(std::string_view key) { _decrement(key); }
+void Abacus::decrement_hash(u64 hash) { _decrement(HashedKey{hash}); }
+
+
 void Abacus::add_layer()
 {
     int bidxlen = _bucket_idx_len;
@@ -105,17 +149,28 @@ void Abacus::add_layer()
     } 
 
     if (_dif_hash) {
+        u32 seed = _rng.next();
+        u32 alt_seed = _rng.next();
         bamboo_layers.push_back(
-            new Bamboo(bidxlen, fgpt_size, fgpt_pb, segi_base, offset));
+            make_bamboo(bidxlen, fgpt_size, fgpt_pb, 
+                segi_base, offset, seed, alt_seed));
     } else {
         bamboo_layers.push_back(
-            new Bamboo(bidxlen, fgpt_size, fgpt_pb, 
+            make_bamboo(bidxlen, fgpt_size, fgpt_pb, 
                 segi_base, offset, _seed, _alt_seed));
     }
+    bamboo_layers.back()->_hash_once = _hash_once;
+    bamboo_layers.back()->_hash_policy = _hash_policy;
     _depth += 1;
 }
 
 
+void Abacus::reserve(u64 expected_items, double target_load)
+{
+    bamboo_layers[0]->reserve(expected_items, target_load);
+}
+
+
 void Abacus::dump_abacus()
 {
     cout << "Dump Abacus Start ===" << endl;
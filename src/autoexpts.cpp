@@ -110,6 +110,65 @@ int main()
     }
 
 
+    /* Same loads, with the filters reserved for *count* items up front */
+    srand(seed);
+    sleep(1);
+    cout << " reserve test start " << endl;
+    for (int count: counts)
+    {
+        u64 total_ns = 0;
+
+        for (int i= 0 ; i< reps; ++ i) {
+            Bamboo bbf = init_bbf_larger();
+
+            t1 = std::chrono::high_resolution_clock::now();
+            bbf.reserve(count);
+            for (int i = 0; i < count; ++i)
+            {
+                r = rand() % universe;
+                bbf.insert(r);
+            }
+
+            t2 = std::chrono::high_resolution_clock::now();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+            total_ns += ns.count();
+        }
+
+        cout << "++++ " << count << ": " << total_ns/reps << " ns" << endl;
+        outfile << count << "\t" << total_ns << "\t" << reps << "\n";
+    }
+
+    srand(seed);
+    sleep(1);
+    cout << " overflow reserve test start " << endl;
+    for (int count: counts)
+    {
+        u64 total_ns = 0;
+        try {
+            for (int i= 0 ; i< reps; ++ i) {
+                BambooOverflow bbf = init_overflow_bbf_larger();
+                
+                t1 = std::chrono::high_resolution_clock::now();
+                bbf.reserve(count);
+                for (int i = 0; i < count; ++i)
+                {
+                    r = rand() % universe;
+                    bbf.insert(r);
+                }
+
+                t2 = std::chrono::high_resolution_clock::now();
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+                total_ns += ns.count();
+            }
+        } catch (const std::exception &e) {
+            cout << e.what() << endl;
+            total_ns = -1;
+        }
+        
+        cout << "++++ " << count << ": " << total_ns/reps << " ns" << endl;
+        outfile << count << "\t" << total_ns << "\t" << reps << "\n";
+    }
+
    
     outfile.close();
 
@@ -2,11 +2,21 @@
 #include <time.h>
 #include <chrono>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <type_traits>
 #include "include/bamboo.hpp"
+#include "include/fixedbamboo.hpp"
+#include "include/expander.hpp"
 
 /* Bamboo Implementation */
 
-/* Constructor. Seeds the hash functions and initializes the segments */
+/* Constructor. Seeds the hash functions and initializes the segments.
+ * Without explicit seeds they are drawn from rand(), so that srand() still
+ * reproduces a run; nothing after construction touches rand() */
 BambooBase::BambooBase(int bucket_idx_len, int fgpt_size, 
         int fgpt_per_bucket, int seg_idx_base) : 
             _num_segments(1 << seg_idx_base),
@@ -19,6 +29,7 @@ BambooBase::BambooBase(int bucket_idx_len, int fgpt_size,
     _bucket_mask = (1<<_bucket_idx_len)-1;
     _seed = rand();
     _alt_seed = rand();
+    _rng.seed((u64) _seed << 32 | _alt_seed);
     
     std::memset(&stats, 0, sizeof(stats));
 }
@@ -34,7 +45,8 @@ BambooBase::BambooBase(int bucket_idx_len, int fgpt_size,
             _seg_idx_base(seg_idx_base),
             _offset(0),
             _seed(seed),
-            _alt_seed(alt_seed) 
+            _alt_seed(alt_seed),
+            _rng((u64) seed << 32 | alt_seed)
 {
     _bucket_mask = (1<<_bucket_idx_len)-1;
     
@@ -54,6 +66,7 @@ BambooBase::BambooBase(int bucket_idx_len, int fgpt_size,
     _bucket_mask = (1<<_bucket_idx_len)-1;
     _seed = rand();
     _alt_seed = rand();
+    _rng.seed((u64) _seed << 32 | _alt_seed);
     
     std::memset(&stats, 0, sizeof(stats));
 }
@@ -69,7 +82,8 @@ BambooBase::BambooBase(int bucket_idx_len, int fgpt_size,
             _seg_idx_base(seg_idx_base),
             _offset(offset),
             _seed(seed),
-            _alt_seed(alt_seed) 
+            _alt_seed(alt_seed),
+            _rng((u64) seed << 32 | alt_seed)
 {
     _bucket_mask = (1<<_bucket_idx_len)-1;
     
@@ -115,11 +129,12 @@ Bamboo::Bamboo(int bucket_idx_len, int fgpt_size, int fgpt_per_bucket,
 
 void Bamboo::_initialize_segments()
 {
-    Segment *s;
-    _trie_head = new BitTrie();
+    _global_depth = _seg_idx_base;
+    _dir_mask = (1 << _global_depth) - 1;
+    _directory.resize(1 << _global_depth);
     for (int idx = 0; idx < _num_segments; ++idx) {
-        s = new Segment(1 << _bucket_idx_len, _fgpt_size, _fgpt_per_bucket, 0);
-        _trie_head->insert(idx, _seg_idx_base, s);
+        _directory[idx] = new Segment(1 << _bucket_idx_len, _fgpt_size, 
+            _fgpt_per_bucket, 0);
     }
 }
 
@@ -127,8 +142,104 @@ void Bamboo::_initialize_segments()
 
 Bamboo::~Bamboo()
 {
-    /* The BitTrie destructor takes care of the rest */
-    delete _trie_head;
+    /* Backwards, so that a segment is freed after all its aliases, which
+     * have higher indices, were looked at */
+    for (u32 i = _directory.size(); i-- > 0; ) {
+        if (!(i >> _local_depth(_directory[i])))
+            delete _directory[i];
+    }
+    for (SplitState *split : _pending_splits)
+        delete split;
+}
+
+
+/* Migrates *_split_step* buckets of the oldest pending split, and frees
+ * the states of the splits that completed */
+void Bamboo::_advance_splits()
+{
+    u32 steps = _split_step;
+    while (!_pending_splits.empty()) {
+        SplitState *split = _pending_splits.front();
+        while (steps && !split->done()) {
+            if (!split->is_migrated(split->next)) {
+                split->src->_migrate(split->next);
+                --steps;
+            }
+            ++split->next;
+        }
+        if (!split->done())
+            return;
+        delete split;
+        _pending_splits.erase(_pending_splits.begin());
+    }
+}
+
+
+void Bamboo::_finish_splits()
+{
+    for (SplitState *split : _pending_splits) {
+        if (!split->done())
+            split->src->finish_split();
+        delete split;
+    }
+    _pending_splits.clear();
+}
+
+
+void Bamboo::_set_segment(u32 seg_idx, u32 depth, Segment *segment)
+{
+    while (depth > _global_depth) {
+        /* The upper half mirrors the lower one */
+        _directory.insert(_directory.end(), _directory.begin(), 
+            _directory.end());
+        ++_global_depth;
+    }
+    _dir_mask = (1 << _global_depth) - 1;
+    for (u32 i = seg_idx; i < _directory.size(); i += 1 << depth)
+        _directory[i] = segment;
+}
+
+
+template <typename... Args>
+Bamboo *_make_bamboo(int bucket_idx_len, int fgpt_size, int fgpt_per_bucket,
+        int seg_idx_base, Args... args)
+{
+    if (fgpt_size == 7 && fgpt_per_bucket == 4)
+        return new BambooFixed<7, 4>(bucket_idx_len, seg_idx_base, args...);
+    if (fgpt_size == 7 && fgpt_per_bucket == 8)
+        return new BambooFixed<7, 8>(bucket_idx_len, seg_idx_base, args...);
+    if (fgpt_size == 7 && fgpt_per_bucket == 16)
+        return new BambooFixed<7, 16>(bucket_idx_len, seg_idx_base, args...);
+    if (fgpt_size == 15 && fgpt_per_bucket == 4)
+        return new BambooFixed<15, 4>(bucket_idx_len, seg_idx_base, args...);
+    if (fgpt_size == 15 && fgpt_per_bucket == 8)
+        return new BambooFixed<15, 8>(bucket_idx_len, seg_idx_base, args...);
+    if (fgpt_size == 15 && fgpt_per_bucket == 16)
+        return new BambooFixed<15, 16>(bucket_idx_len, seg_idx_base, args...);
+    return new Bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, 
+        seg_idx_base, args...);
+}
+
+
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, int fgpt_per_bucket,
+        int seg_idx_base)
+{
+    return _make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, 
+        seg_idx_base);
+}
+
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, int fgpt_per_bucket,
+        int seg_idx_base, int offset)
+{
+    return _make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, 
+        seg_idx_base, offset);
+}
+
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, int fgpt_per_bucket,
+        int seg_idx_base, int offset, u32 seed, u32 alt_seed)
+{
+    return _make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, 
+        seg_idx_base, offset, seed, alt_seed);
 }
 
 
@@ -166,18 +277,46 @@ int BambooBase::count(int elt)
     u32 fgpt;
     u32 bidx1, bidx2, seg_idx;
     Segment *segment;
+    OpGuard guard(_op_mutex);
     if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
         return false;
+    return _count_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+int BambooBase::_count_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+        u32 bidx2)
+{
     int count = 0;
     while (segment) 
     {
-        count += segment->buckets[bidx1].count_fgpt(fgpt) 
-            + segment->buckets[bidx2].count_fgpt(fgpt);
+        count += _count_segment(segment, fgpt, bidx1, bidx2);
         segment = segment->overflow;
     }
     return count;
 }
 
+/* Whether *elt* is in the filter, see contains() */
+bool BambooBase::contains(int elt)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    Segment *segment;
+    OpGuard guard(_op_mutex);
+    if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
+        return false;
+    return _contains_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+bool BambooBase::_contains_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+        u32 bidx2)
+{
+    for (; segment; segment = segment->overflow) {
+        if (_contains_segment(segment, fgpt, bidx1, bidx2))
+            return true;
+    }
+    return false;
+}
+
 /* Insert an element into the Bamboo filter. 
  * Will call cuckoo-insertion if both buckets of elt are full*/
 bool BambooBase::insert(int elt)
@@ -187,9 +326,15 @@ bool BambooBase::insert(int elt)
     bool r = false;
     Segment *segment;
 
+    OpGuard guard(_op_mutex);
+    _advance_splits();
     if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
         goto ret;
+    if (segment->_packed)
+        segment->unpack();
     r =  insert(elt, fgpt, seg_idx, segment, bidx1, bidx2);
+    if (r && _tracks_load())
+        _note_load(segment, seg_idx, 1);
 ret:
     return r;
 }
@@ -197,30 +342,34 @@ ret:
 bool BambooBase::insert(int elt, u32 fgpt, u32 seg_idx, Segment *segment,
             u32 bidx1, u32 bidx2)
 {
-    bool r = !segment->buckets[bidx1].insert_fgpt(fgpt) 
-            || !segment->buckets[bidx2].insert_fgpt(fgpt)
+    segment->settle(bidx1);
+    segment->settle(bidx2);
+    bool r = !segment->bucket(bidx1).insert_fgpt(fgpt) 
+            || !segment->bucket(bidx2).insert_fgpt(fgpt)
             || _cuckoo(segment, seg_idx, bidx1, bidx2, fgpt, 1, 1);
     return r;
 }
 
 
-bool BambooOverflow::insert(int elt) 
+/* Same as for Bamboo, but every *_expand_prompt* inserts the next segment
+ * in line is split */
+bool BambooOverflow::insert(int elt, u32 fgpt, u32 seg_idx, Segment *segment,
+            u32 bidx1, u32 bidx2)
 {
     bool r = false;
     
-    if(BambooBase::insert(elt))
+    if(BambooBase::insert(elt, fgpt, seg_idx, segment, bidx1, bidx2))
     {
         // auto t1 = std::chrono::high_resolution_clock::now();
         _insert_count += 1;
         if(_insert_count == _expand_prompt)
         {
             _insert_count = 0;
-            expand(_next_seg_idx);
-            _next_seg_idx += 1;
-            if(_next_seg_idx == 1<<(_expand_base+_seg_idx_base))
-            {
-                _next_seg_idx = 0;
-                _expand_base += 1;
+            if (_expander) {
+                ++_pending_expands;
+                _expander->notify();
+            } else {
+                _expand_next();
             }
         }
         r = true;
@@ -233,18 +382,172 @@ bool BambooOverflow::insert(int elt)
     return r;
 }
 
+
+void BambooOverflow::_expand_next()
+{
+    expand(_next_seg_idx);
+    _next_seg_idx += 1;
+    if(_next_seg_idx == 1<<(_expand_base+_seg_idx_base))
+    {
+        _next_seg_idx = 0;
+        _expand_base += 1;
+    }
+}
+
+
+bool BambooOverflow::_background_step()
+{
+    if (!_pending_expands)
+        return false;
+    --_pending_expands;
+    _expand_next();
+    return _pending_expands > 0;
+}
+
+
+/* Hashed-key API, see insert_hash() */
+
+int BambooBase::count_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    Segment *segment;
+    OpGuard guard(_op_mutex);
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    return _count_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+bool BambooBase::contains_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    Segment *segment;
+    OpGuard guard(_op_mutex);
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    return _contains_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+bool BambooBase::insert_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    Segment *segment;
+    OpGuard guard(_op_mutex);
+    _advance_splits();
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    if (segment->_packed)
+        segment->unpack();
+    bool r = insert((int) hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    if (r && _tracks_load())
+        _note_load(segment, seg_idx, 1);
+    return r;
+}
+
+bool BambooBase::remove_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    Segment *segment;
+    OpGuard guard(_op_mutex);
+    _advance_splits();
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    bool r = _remove_extracted(fgpt, segment, bidx1, bidx2);
+    if (r && _tracks_load())
+        _note_load(segment, seg_idx, -1);
+    if (r)
+        _note_remove();
+    return r;
+}
+
+/* Batched lookups, see count_batch() */
+
+void BambooBase::count_batch(const int *keys, size_t n, u32 *counts)
+{
+    _count_batch(keys, n, counts);
+}
+
+void BambooBase::count_batch(const u64 *keys, size_t n, u32 *counts)
+{
+    _count_batch(keys, n, counts);
+}
+
+void BambooBase::contains_batch(const int *keys, size_t n, bool *found)
+{
+    _count_batch(keys, n, found);
+}
+
+void BambooBase::contains_batch(const u64 *keys, size_t n, bool *found)
+{
+    _count_batch(keys, n, found);
+}
+
+template <typename Key, typename Out>
+void BambooBase::_count_batch(const Key *keys, size_t n, Out *out)
+{
+    u32 fgpt[BATCH_WINDOW], hashfrag[BATCH_WINDOW];
+    u32 bidx1[BATCH_WINDOW], bidx2[BATCH_WINDOW];
+    Segment *segment[BATCH_WINDOW];
+    u32 seg_idx;
+    for (size_t base = 0; base < n; base += BATCH_WINDOW) {
+        int m = std::min<size_t>(BATCH_WINDOW, n - base);
+        /* The expander may not split a segment between the passes */
+        OpGuard guard(_op_mutex);
+        for (int i = 0; i < m; ++i) {
+            _route(keys[base + i], fgpt[i], hashfrag[i], bidx1[i]);
+            _prefetch_route(hashfrag[i]);
+        }
+        for (int i = 0; i < m; ++i) {
+            segment[i] = _get_segment(hashfrag[i], seg_idx);
+            bidx2[i] = _alt_bucket(fgpt[i], bidx1[i]);
+            if (segment[i]->_packed)
+                continue;
+            u32 len = segment[i]->_bucket_len;
+            __builtin_prefetch(segment[i]->_slab + bidx1[i] * len);
+            __builtin_prefetch(segment[i]->_slab + bidx2[i] * len);
+        }
+        for (int i = 0; i < m; ++i) {
+            if constexpr (std::is_same_v<Out, bool>)
+                out[base + i] = _contains_extracted(fgpt[i], segment[i], 
+                    bidx1[i], bidx2[i]);
+            else
+                out[base + i] = _count_extracted(fgpt[i], segment[i], 
+                    bidx1[i], bidx2[i]);
+        }
+    }
+}
+
+
 /* Removes a copy of *elt* from the filter */
 bool BambooBase::remove(int elt)
 {
     u32 fgpt;
     u32 bidx1, bidx2, seg_idx;
     Segment *segment;
+    OpGuard guard(_op_mutex);
+    _advance_splits();
     if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
         return false;
+    bool r = _remove_extracted(fgpt, segment, bidx1, bidx2);
+    if (r && _tracks_load())
+        _note_load(segment, seg_idx, -1);
+    if (r)
+        _note_remove();
+    return r;
+}
+
+bool BambooBase::_remove_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+        u32 bidx2)
+{
     while (segment)
     {
-        if(segment->buckets[bidx1].remove_fgpt(fgpt)
-            || segment->buckets[bidx2].remove_fgpt(fgpt))
+        if (segment->_packed)
+            segment->unpack();
+        segment->settle(bidx1);
+        segment->settle(bidx2);
+        if(segment->bucket(bidx1).remove_fgpt(fgpt)
+            || segment->bucket(bidx2).remove_fgpt(fgpt)
+            || (segment->_stash_len 
+                && segment->remove_stash(bidx1, bidx2, fgpt)))
             return true;
         segment = segment->overflow;
     }
@@ -252,116 +555,742 @@ bool BambooBase::remove(int elt)
 }
 
 
-/* Main cuckoo-insertion logic */
+/* Main cuckoo-insertion logic. A random walk, run as a loop so that long
+ * chains need no stack */
 bool BambooBase::_cuckoo(Segment *segment, u32 seg_idx, u32 bi_main, u32 bi_alt, 
         u32 fgpt, u32 fgpt_cnt, u32 chain_len)
 {
-    ++stats._counter0;
-    if (chain_len == _chain_max) {
-        // cout << "Chain max " << _chain_max << " reached, attempt to expand segment" << endl;
-        ++stats._counter1;
-        return overflow(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
-    }
+    if (_bfs_cuckoo)
+        return _cuckoo_bfs(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
 
     int evict_bidx, evict_idx;
-    u32 evict_fgpt, evict_fgpt_cnt;
-    int i = 0;
-    /* Can fine-tune the eviction strategy ... */
-
-    /* Try randomly evicting from the alt - hope that we pick a different 
-     * fingerprint.*/
-    evict_bidx = bi_alt;
-    evict_idx = rand() % _fgpt_per_bucket;
-    if (!segment->buckets[evict_bidx].count_fgpt_at(fgpt, evict_idx)) {
-        evict_fgpt = segment->buckets[evict_bidx]
-            .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
-        goto evict;
-    }
-
-    /* Else check all elements for a different fingerprint to evict.
-     * Prioritize the alt bucket to prevent bouncing. Roughly mirrors
-     * the logic of the original 2014 Cuckoo filter paper. */
-    for (int bidx : {bi_alt, bi_main}) {
-        for (evict_idx = 0; evict_idx < _fgpt_per_bucket; ++evict_idx) {
-            if (!segment->buckets[bidx].count_fgpt_at(fgpt, evict_idx)) {
-                evict_fgpt = segment->buckets[bidx]
-                    .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
-                evict_bidx = bidx;
-                goto evict;
+    u32 evict_fgpt, evict_fgpt_cnt, alt_bidx;
+    for (;; ++chain_len) {
+        if (!_shared_fill)
+            ++stats._counter0;
+        if (chain_len >= _chain_bound()) {
+            // cout << "Chain max " << _chain_max << " reached, attempt to expand segment" << endl;
+            if (!_shared_fill)
+                ++stats._counter1;
+            return _stash_put(segment, bi_main, fgpt, fgpt_cnt)
+                || overflow(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
+        }
+
+        int i = 0;
+        segment->settle(bi_main);
+        segment->settle(bi_alt);
+        /* Can fine-tune the eviction strategy ... */
+
+        /* Try randomly evicting from the alt - hope that we pick a different 
+         * fingerprint.*/
+        evict_bidx = bi_alt;
+        evict_idx = _victim_slot();
+        if (!segment->bucket(evict_bidx).count_fgpt_at(fgpt, evict_idx)) {
+            evict_fgpt = segment->bucket(evict_bidx)
+                .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
+            goto evict;
+        }
+
+        /* Else check all elements for a different fingerprint to evict.
+         * Prioritize the alt bucket to prevent bouncing. Roughly mirrors
+         * the logic of the original 2014 Cuckoo filter paper. */
+        for (int bidx : {bi_alt, bi_main}) {
+            for (evict_idx = 0; evict_idx < _fgpt_per_bucket; ++evict_idx) {
+                if (!segment->bucket(bidx).count_fgpt_at(fgpt, evict_idx)) {
+                    evict_fgpt = segment->bucket(bidx)
+                        .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
+                    evict_bidx = bidx;
+                    goto evict;
+                }
+                i += 1;
             }
-            i += 1;
         }
-    }
 
-    /* Both buckets are filled by the same fingerprint - nothing we can evict */
+        /* Both buckets are filled by the same fingerprint - nothing we can evict */
 
-    /* In the overflow segment case, this is probably allowed (?) */
-    cout << "This item is represented " << i << " times in the filter."
-        << " Both buckets filled by the same fingerprint - cuckoo not possible" << endl;
-    cout << "Params: " << segment << " " << seg_idx << " " << bi_main << " " << bi_alt 
-        << " " << bitset<32>(fgpt) << " " << chain_len << endl;
-    throw std::runtime_error("Bucket capacity reached");
+        /* In the overflow segment case, this is probably allowed (?) */
+        cout << "This item is represented " << i << " times in the filter."
+            << " Both buckets filled by the same fingerprint - cuckoo not possible" << endl;
+        cout << "Params: " << segment << " " << seg_idx << " " << bi_main << " " << bi_alt 
+            << " " << bitset<32>(fgpt) << " " << chain_len << endl;
+        throw std::runtime_error("Bucket capacity reached");
 
 evict:
-    /* Insert the current fingerprint in the new vacancy */
-    segment->buckets[evict_bidx].insert_fgpt_count_at(evict_idx, fgpt, fgpt_cnt);
-    /* Compute the other bucket for the evicted fingerprint */
-    u32 alt_bidx = _alt_bucket(evict_fgpt, evict_bidx);
-    
-    /* Try to insert the evicted fingerprint in the alt bucket*/
-    if (!segment->buckets[alt_bidx].insert_fgpt_count(evict_fgpt, evict_fgpt_cnt)) {
-        // cout << "Chain: " << chain_len << endl;
-        return true;
+        /* Insert the current fingerprint in the new vacancy */
+        segment->bucket(evict_bidx).insert_fgpt_count_at(evict_idx, fgpt, fgpt_cnt);
+        /* Compute the other bucket for the evicted fingerprint */
+        alt_bidx = _alt_bucket(evict_fgpt, evict_bidx);
+        segment->settle(alt_bidx);
+        
+        /* Try to insert the evicted fingerprint in the alt bucket*/
+        if (!segment->bucket(alt_bidx).insert_fgpt_count(evict_fgpt, evict_fgpt_cnt)) {
+            // cout << "Chain: " << chain_len << endl;
+            if (_expand_policy == EXPAND_ADAPTIVE)
+                _chain_avg += ((int) chain_len * 16 - _chain_avg) / 16;
+            return true;
+        }
+
+        /* Continue with the evicted fingerprint */
+        bi_main = evict_bidx;
+        bi_alt = alt_bidx;
+        fgpt = evict_fgpt;
+        fgpt_cnt = evict_fgpt_cnt;
     }
+}
 
 
-    
-    return _cuckoo(segment, seg_idx, evict_bidx, alt_bidx, evict_fgpt, 
-            evict_fgpt_cnt, chain_len+1);
+/* Breadth-first cuckoo insertion: searches the buckets reachable from
+ * *bi_main* and *bi_alt* by moving one entry to its alt bucket, level by
+ * level, until one has a vacant slot. Only then the entries on the path
+ * move, each one step towards the vacancy, and *fgpt* takes the freed slot.
+ * At most _chain_bound() buckets are searched before overflow() */
+bool BambooBase::_cuckoo_bfs(Segment *segment, u32 seg_idx, u32 bi_main, 
+        u32 bi_alt, u32 fgpt, u32 fgpt_cnt)
+{
+    u32 budget = _chain_bound();
+    vector<CuckooNode> &nodes = _bfs_nodes;
+    nodes.clear();
+    if (_bfs_seen.size() < ((1u << _bucket_idx_len) + 63) / 64)
+        _bfs_seen.resize(((1u << _bucket_idx_len) + 63) / 64);
+
+    int found = -1;
+    auto visit = [&](u32 bidx, int parent, int slot) {
+        _bfs_seen[bidx >> 6] |= (u64) 1 << (bidx & 63);
+        nodes.push_back({bidx, parent, slot});
+        segment->settle(bidx);
+        if (segment->bucket(bidx).occupied_mask() 
+                != segment->bucket(bidx)._slot_mask())
+            found = nodes.size() - 1;
+    };
+    auto seen = [&](u32 bidx) {
+        return _bfs_seen[bidx >> 6] >> (bidx & 63) & 1;
+    };
+
+    visit(bi_main, -1, -1);
+    if (found < 0 && !seen(bi_alt))
+        visit(bi_alt, -1, -1);
+    for (u32 head = 0; found < 0 && head < nodes.size(); ++head) {
+        u32 bidx = nodes[head].bidx;
+        Bucket b = segment->bucket(bidx);
+        for (int slot = 0; found < 0 && slot < _fgpt_per_bucket; ++slot) {
+            u32 alt_bidx = _alt_bucket(b.get_fgpt_at(slot), bidx);
+            if (seen(alt_bidx))
+                continue;
+            if (nodes.size() >= budget)
+                goto search_done;
+            visit(alt_bidx, head, slot);
+        }
+    }
+
+search_done:
+    for (CuckooNode &node : nodes)
+        _bfs_seen[node.bidx >> 6] = 0;
+    if (found < 0) {
+        ++stats._counter1;
+        return _stash_put(segment, bi_main, fgpt, fgpt_cnt)
+            || overflow(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
+    }
+
+    /* Moves along the path, starting at the vacancy */
+    int n = found;
+    for (; nodes[n].parent >= 0; n = nodes[n].parent) {
+        Bucket from = segment->bucket(nodes[nodes[n].parent].bidx);
+        u32 entry = from.get_entry_at(nodes[n].slot);
+        from.reset_entry_at(nodes[n].slot);
+        segment->bucket(nodes[n].bidx).insert_entry(entry);
+        ++stats._counter0;
+    }
+    /* Both copies of a count of 2 share a slot */
+    segment->bucket(nodes[n].bidx).insert_fgpt_count(fgpt, fgpt_cnt);
+    if (_expand_policy == EXPAND_ADAPTIVE)
+        _chain_avg += ((int) nodes.size() * 16 - _chain_avg) / 16;
+    return true;
 }
 
-/* Expands the filter by adding a new segment and relocating fingerprints
- * based on "partial-key linear hashing". */
-bool Bamboo::overflow(Segment *segment, u32 seg_idx, u32 bidx1, u32 bidx2, 
-        u32 fgpt, u32 fgpt_cnt)
+/* Background expansion, see BackgroundExpander */
+
+void Bamboo::_note_load(Segment *segment, u32 seg_idx, int delta)
 {
-    std::chrono::_V2::high_resolution_clock::time_point t1,t2;
-    std::chrono::_V2::system_clock::duration ns;
+    if (delta < 0 && !segment->_load)
+        return;
+    segment->_load += delta;
+    if (delta < 0)
+        return;
+    u32 slots = segment->num_buckets * _fgpt_per_bucket;
+    if (_expander) {
+        if (segment->_load == (u32) (_presplit_load * slots)) {
+            _presplit_queue.push_back({segment, seg_idx});
+            _expander->notify();
+        }
+        return;
+    }
+    /* EXPAND_ON_LOAD */
+    if (segment->_load >= _expand_load * slots 
+            && segment->expansion_count + 1 < _fgpt_size) {
+        ++stats._expand_count;
+        split(segment, seg_idx);
+    }
+}
 
-    t1 = std::chrono::high_resolution_clock::now();
 
-    ++stats._expand_count;
-    int expansion_count = ++segment->expansion_count;
+bool Bamboo::_background_step()
+{
+    while (!_presplit_queue.empty()) {
+        Segment *segment = _presplit_queue.back().first;
+        u32 seg_idx = _presplit_queue.back().second;
+        _presplit_queue.pop_back();
+        /* It may have been split by a foreground insert since */
+        if (segment->_load < (u32) (_presplit_load * segment->num_buckets 
+                * _fgpt_per_bucket)
+                || segment->expansion_count + 1 >= _fgpt_size)
+            continue;
+        ++stats._expand_count;
+        split(segment, seg_idx);
+        return true;
+    }
+    /* With no steps, lazy splits only migrate on touch */
+    if (_pending_splits.empty() || !_split_step)
+        return false;
+    _advance_splits();
+    return !_pending_splits.empty();
+}
+
+
+/* _note_load() queues a segment for the expander as its load reaches the
+ * pre-split load, so the segments already past it are queued here */
+void Bamboo::_init_load()
+{
+    for_each_segment([&](Segment *segment, u32 seg_idx) {
+        segment->_load = segment->occupancy();
+        if (_expander && segment->_load >= (u32) (_presplit_load
+                * segment->num_buckets * _fgpt_per_bucket)
+                && segment->expansion_count + 1 < _fgpt_size)
+            _presplit_queue.push_back({segment, seg_idx});
+    });
+    if (_expander && !_presplit_queue.empty())
+        _expander->notify();
+}
+
+
+/* Splits *segment* in two by the next bit of the fgpts, "partial-key linear
+ * hashing". The low half stays in *segment* at index *seg_idx*; returns the
+ * high half. Fgpts move at once, or lazily with *_lazy_split* */
+Segment *Bamboo::split(Segment *segment, u32 seg_idx)
+{
+    /* Both halves must be whole before splitting again */
+    segment->finish_split();
+    int expansion_count = segment->expansion_count + 1;
     if (expansion_count >= _fgpt_size) 
         throw std::runtime_error("Bamboo max expansion capacity breached");
+    segment->expansion_count = expansion_count;
     
     u8 ilen = expansion_count + _seg_idx_base;
     u32 new_idx = seg_idx | (1 << (ilen - 1));
 
     // cout << "Expanding segment " << bitset<16>(seg_idx) << " into segment " << bitset<16>(new_idx) 
     //     << " : Expansion count = " << expansion_count  
-    //     << " ilen = " << (u32) ilen << " to insert " << bitset<16>(fgpt) << endl; 
-    // cout << "Before expand: occupancy = " << occupancy() << endl;
+    //     << " ilen = " << (u32) ilen << endl; 
     Segment *new_segment = new Segment(1 << _bucket_idx_len, _fgpt_size, 
         _fgpt_per_bucket, expansion_count);
-    _trie_head->insert(new_idx, ilen, new_segment);
-    _trie_head->insert(seg_idx, ilen, segment);
-    _trie_head->clear(seg_idx, ilen-1);
-    // _trie_head->dump("");
+    _set_segment(new_idx, ilen, new_segment);
     
-    for (int i = 0; i < (1 << _bucket_idx_len); i++) {
-        segment->buckets[i]
-            .split_bucket(new_segment->buckets[i], expansion_count-1);
+    if (_lazy_split) {
+        SplitState *split = new SplitState{segment, new_segment, 
+            expansion_count-1, 0, 0, 
+            vector<u64>(((1 << _bucket_idx_len) + 63) / 64, 0)};
+        segment->_split = split;
+        new_segment->_split = split;
+        _pending_splits.push_back(split);
+    } else {
+        for (int i = 0; i < (1 << _bucket_idx_len); i++) {
+            segment->bucket(i)
+                .split_bucket(new_segment->bucket(i), expansion_count-1);
+        }
+    }
+    /* The stash goes back to the buckets of the half each fgpt moves to */
+    segment->drain_stash([&](u32 bidx, u32 entry) {
+        Segment *half = (1 << (expansion_count-1)) & (entry >> 1) ?
+            new_segment : segment;
+        u32 alt_bidx = _alt_bucket(entry >> 1, bidx);
+        half->settle(bidx);
+        half->settle(alt_bidx);
+        if (!half->bucket(bidx).insert_entry(entry)
+                && !half->bucket(alt_bidx).insert_entry(entry))
+            /* Not _stash_put(), which would drop it if _stash_size was
+             * lowered since. The halves get at most the drained entries */
+            half->_stash[half->_stash_len++] = {entry, bidx};
+    });
+    /* Expected share of each half */
+    segment->_load /= 2;
+    new_segment->_load = segment->_load;
+    ++_num_segments;
+    return new_segment;
+}
+
+
+/* Segment merging */
+
+int Bamboo::shrink()
+{
+    OpGuard guard(_op_mutex);
+    return _shrink();
+}
+
+
+int Bamboo::_shrink()
+{
+    _finish_splits();
+    /* The queued segments may be merged away */
+    _presplit_queue.clear();
+
+    int merges = 0;
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (u32 i = 0; i < _directory.size(); ++i) {
+            Segment *low = _directory[i];
+            u32 depth = _local_depth(low);
+            if (i >> depth || depth == (u32) _seg_idx_base 
+                    || i >> (depth - 1))
+                continue;
+            Segment *high = _directory[i | (1 << (depth - 1))];
+            if (_local_depth(high) != depth)
+                continue;
+            if (low->occupancy() + high->occupancy() > _merge_load 
+                    * low->num_buckets * _fgpt_per_bucket)
+                continue;
+            Segment *segment = _merge(low, high);
+            if (!segment)
+                continue;
+            _set_segment(i, depth - 1, segment);
+            delete low;
+            delete high;
+            --_num_segments;
+            ++merges;
+            merged = true;
+        }
+    }
+
+    u32 max_depth = _seg_idx_base;
+    for_each_segment([&](Segment *segment, u32) {
+        max_depth = std::max(max_depth, _local_depth(segment));
+    });
+    if (max_depth < _global_depth) {
+        /* The upper halves only mirror the lower ones */
+        _global_depth = max_depth;
+        _dir_mask = (1 << _global_depth) - 1;
+        _directory.resize(1 << _global_depth);
+        _directory.shrink_to_fit();
+    }
+    return merges;
+}
+
+
+/* Returns a new segment holding the fgpts of the siblings *low* and *high*
+ * with one expansion less, or null if they did not fit. Either way both
+ * keep their fgpts */
+Segment *Bamboo::_merge(Segment *low, Segment *high)
+{
+    low->unpack();
+    high->unpack();
+    Segment *segment = new Segment(1 << _bucket_idx_len, _fgpt_size, 
+        _fgpt_per_bucket, low->expansion_count - 1);
+    for (Segment *half : {low, high}) {
+        for (u32 i = 0; i < (1u << _bucket_idx_len); ++i) {
+            Bucket b = half->bucket(i);
+            for (u64 occ = b.occupied_mask(); occ; occ &= occ - 1) {
+                if (!_place_entry(segment, i, 
+                        b.get_entry_at(__builtin_ctzll(occ)))) {
+                    delete segment;
+                    return nullptr;
+                }
+            }
+        }
+        for (int i = 0; i < half->_stash_len; ++i) {
+            if (!_place_entry(segment, half->_stash[i].bidx, 
+                    half->_stash[i].entry)) {
+                delete segment;
+                return nullptr;
+            }
+        }
+    }
+    segment->_load = low->_load + high->_load;
+    return segment;
+}
+
+
+/* Puts *entry*, whose fgpt hashed to bucket *bidx*, in its bucket pair,
+ * evicting for at most *_chain_max* steps. Unlike _cuckoo() it never 
+ * splits; a failure leaves some entry out */
+bool Bamboo::_place_entry(Segment *segment, u32 bidx, u32 entry)
+{
+    if (segment->bucket(bidx).insert_entry(entry))
+        return true;
+    bidx = _alt_bucket(entry >> 1, bidx);
+    for (u32 chain = 0; chain < _chain_max; ++chain) {
+        Bucket b = segment->bucket(bidx);
+        if (b.insert_entry(entry))
+            return true;
+        int idx = _rng.below(_fgpt_per_bucket);
+        u32 evicted = b.get_entry_at(idx);
+        b.reset_entry_at(idx);
+        b.insert_entry(entry);
+        entry = evicted;
+        bidx = _alt_bucket(entry >> 1, bidx);
+    }
+    return false;
+}
+
+
+void Bamboo::_note_remove()
+{
+    if (_shrink_load <= 0 || ++_removes < capacity() / 16)
+        return;
+    _removes = 0;
+    if (occupancy() < _shrink_load * capacity())
+        _shrink();
+}
+
+
+u32 BambooBase::_reserve_depth(u64 expected_items, double target_load)
+{
+    double per_segment = target_load * (1 << _bucket_idx_len) 
+        * _fgpt_per_bucket;
+    u64 segments = (u64) std::ceil(expected_items / per_segment);
+    u32 depth = _seg_idx_base;
+    while ((1ull << depth) < segments)
+        ++depth;
+    if (depth - _seg_idx_base >= (u32) _fgpt_size)
+        throw std::runtime_error("Bamboo reserve exceeds max expansion capacity");
+    return depth;
+}
+
+
+void Bamboo::reserve(u64 expected_items, double target_load)
+{
+    OpGuard guard(_op_mutex);
+    _reserve(expected_items, target_load);
+}
+
+
+void Bamboo::_reserve(u64 expected_items, double target_load)
+{
+    u32 depth = _reserve_depth(expected_items, target_load);
+
+    /* The segments are (nearly) empty, so splitting at once is cheap */
+    bool lazy = _lazy_split;
+    _lazy_split = false;
+    _finish_splits();
+    u32 seg_idx;
+    for (u32 i = 0; i < (1u << depth); ++i) {
+        Segment *segment = _get_segment(i, seg_idx);
+        while (_local_depth(segment) < depth) {
+            split(segment, seg_idx);
+            segment = _get_segment(i, seg_idx);
+        }
+    }
+    _lazy_split = lazy;
+}
+
+
+/* Parallel bulk build */
+
+/* An fgpt whose cuckoo chain failed during the parallel fill. *base* are
+ * the low *_seg_idx_base* bits of its segment index, which with the fgpt
+ * locate its segment again after splits (see _extract_hash) */
+struct DeferredEntry {
+    u32 fgpt;
+    u32 fgpt_cnt;
+    u32 bi_main;
+    u32 bi_alt;
+    u32 base;
+};
+
+/* A group of segments as one worker fills it, with its own generator 
+ * for the victim slots and the fgpts it defers, so that neither depends
+ * on which worker took it or when */
+struct BuildGroup {
+    FastRand rng;
+    vector<DeferredEntry> deferred;
+};
+
+struct BuildState {
+    vector<BuildGroup> groups;
+};
+
+/* The group the calling worker fills */
+static thread_local BuildGroup *_build_group = nullptr;
+
+
+/* Runs *work(t)* for t in [0, threads), on threads unless there is one.
+ * Rethrows the first exception of a worker after all joined */
+template <typename F>
+static void _run_threads(int threads, F &&work)
+{
+    if (threads <= 1) {
+        work(0);
+        return;
+    }
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                work(t);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        });
     }
+    for (std::thread &w : workers)
+        w.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+void Bamboo::build(const u64 *keys, size_t n, int threads, 
+        double target_load)
+{
+    OpGuard guard(_op_mutex);
+    threads = std::max(threads, 1);
+    _reserve(occupancy() + n, target_load);
+    for_each_segment([](Segment *segment, u32) {
+        segment->unpack();
+    });
+
+    /* Hash and count the keys per group of segments. A segment's keys 
+     * share its index, so the low index bits keep them in one group; a 
+     * group is a few hundred KB of buckets, and few groups keep the 
+     * scatter below sequential. After _reserve() no segment is split 
+     * while the workers run, so the directory holds */
+    u32 groups = std::min<u32>(_directory.size(), 256);
+    vector<u64> hashes(n);
+    vector<u8> group_of(n);
+    vector<vector<size_t>> offsets(threads, vector<size_t>(groups, 0));
+    auto chunk = [&](int t, size_t &lo, size_t &hi) {
+        lo = n * t / threads;
+        hi = n * (t + 1) / threads;
+    };
+    _run_threads(threads, [&](int t) {
+        u32 fgpt, seg_idx, bidx1, bidx2;
+        Segment *segment;
+        size_t lo, hi;
+        chunk(t, lo, hi);
+        for (size_t i = lo; i < hi; ++i) {
+            hashes[i] = _compute_hash64(keys[i]);
+            _extract_hash(hashes[i], fgpt, seg_idx, segment, bidx1, bidx2);
+            group_of[i] = seg_idx & (groups - 1);
+            ++offsets[t][group_of[i]];
+        }
+    });
+
+    /* Exclusive prefix sums, by group first and thread second, so each
+     * thread scatters its chunk into disjoint ranges */
+    vector<size_t> starts(groups + 1);
+    size_t sum = 0;
+    for (u32 g = 0; g < groups; ++g) {
+        starts[g] = sum;
+        for (int t = 0; t < threads; ++t) {
+            size_t cnt = offsets[t][g];
+            offsets[t][g] = sum;
+            sum += cnt;
+        }
+    }
+    starts[groups] = sum;
+
+    vector<u64> sorted(n);
+    _run_threads(threads, [&](int t) {
+        size_t lo, hi;
+        chunk(t, lo, hi);
+        for (size_t i = lo; i < hi; ++i)
+            sorted[offsets[t][group_of[i]]++] = hashes[i];
+    });
+    vector<u64>().swap(hashes);
+    vector<u8>().swap(group_of);
+
+    /* Fill: each group is filled by one thread. The walk shares no 
+     * scratch space between threads, the BFS search does, and 
+     * EXPAND_ADAPTIVE a running average */
+    BuildState state;
+    state.groups.resize(groups);
+    u64 seed = _rng.next();
+    for (u32 g = 0; g < groups; ++g)
+        state.groups[g].rng.seed(seed + g * 0x9e3779b97f4a7c15ull);
+    bool bfs = _bfs_cuckoo;
+    ExpandPolicy policy = _expand_policy;
+    _bfs_cuckoo = false;
+    _expand_policy = EXPAND_ON_FAILURE;
+    _shared_fill = true;
+    _build = &state;
+    std::atomic<u32> next_group(0);
+    try {
+        _run_threads(threads, [&](int) {
+            u32 fgpt, seg_idx, bidx1, bidx2;
+            Segment *segment;
+            for (u32 g; (g = next_group++) < groups; ) {
+                _build_group = &state.groups[g];
+                for (size_t i = starts[g]; i < starts[g + 1]; ++i) {
+                    _extract_hash(sorted[i], fgpt, seg_idx, segment, bidx1, 
+                        bidx2);
+                    insert((int) sorted[i], fgpt, seg_idx, segment, bidx1, 
+                        bidx2);
+                }
+            }
+        });
+    } catch (...) {
+        _build = nullptr;
+        _shared_fill = false;
+        _bfs_cuckoo = bfs;
+        _expand_policy = policy;
+        throw;
+    }
+    _build = nullptr;
+    _shared_fill = false;
+    _bfs_cuckoo = bfs;
+    _expand_policy = policy;
+
+    /* Sequentially in group order, splitting where needed */
+    for (BuildGroup &group : state.groups) {
+        for (DeferredEntry &e : group.deferred) {
+            u32 seg_idx;
+            Segment *segment = _get_segment(
+                (e.fgpt << _seg_idx_base) | e.base, seg_idx);
+            segment->settle(e.bi_main);
+            segment->settle(e.bi_alt);
+            !segment->bucket(e.bi_main).insert_fgpt_count(e.fgpt, e.fgpt_cnt)
+                || !segment->bucket(e.bi_alt)
+                    .insert_fgpt_count(e.fgpt, e.fgpt_cnt)
+                || _cuckoo(segment, seg_idx, e.bi_main, e.bi_alt, e.fgpt, 
+                    e.fgpt_cnt, 1);
+        }
+    }
+    if (_tracks_load())
+        _init_load();
+}
+
+
+/* Stable LSD radix sort of *keys* by the low *bits* bits of their hash
+ * fragment, a byte per pass. *tmp* is scratch space */
+static void _sort_by_prefix(vector<RoutedKey> &keys, vector<RoutedKey> &tmp,
+        u32 bits)
+{
+    tmp.resize(keys.size());
+    for (u32 shift = 0; shift < bits; shift += 8) {
+        u32 mask = (1u << std::min<u32>(bits - shift, 8)) - 1;
+        size_t offsets[256] = {0};
+        for (RoutedKey &k : keys)
+            ++offsets[k.hashfrag >> shift & mask];
+        size_t sum = 0;
+        for (u32 d = 0; d <= mask; ++d) {
+            size_t cnt = offsets[d];
+            offsets[d] = sum;
+            sum += cnt;
+        }
+        for (RoutedKey &k : keys)
+            tmp[offsets[k.hashfrag >> shift & mask]++] = k;
+        keys.swap(tmp);
+    }
+}
+
+
+size_t Bamboo::insert_batch(const int *keys, size_t n)
+{
+    return _insert_batch(keys, n);
+}
+
+size_t Bamboo::insert_batch(const u64 *keys, size_t n)
+{
+    return _insert_batch(keys, n);
+}
+
+template <typename Key>
+size_t Bamboo::_insert_batch(const Key *keys, size_t n)
+{
+    vector<RoutedKey> routed(n), tmp;
+    for (size_t i = 0; i < n; ++i)
+        _route(keys[i], routed[i].fgpt, routed[i].hashfrag, routed[i].bidx1);
+    /* A filter that grows on the way ends up at least as deep as *n* 
+     * keys need, and sorting by those bits keeps the halves of later 
+     * splits apart already */
+    u32 bits = _global_depth;
+    u64 slots = (u64) _fgpt_per_bucket << _bucket_idx_len;
+    while (bits < (u32) (_seg_idx_base + _fgpt_size - 1) 
+            && (slots << bits) < n)
+        ++bits;
+    _sort_by_prefix(routed, tmp, bits);
+    vector<RoutedKey>().swap(tmp);
+
+    /* As insert(), but for the routing */
+    size_t inserted = 0;
+    u32 seg_idx, bidx2;
+    for (RoutedKey &k : routed) {
+        OpGuard guard(_op_mutex);
+        _advance_splits();
+        Segment *segment = _get_segment(k.hashfrag, seg_idx);
+        bidx2 = _alt_bucket(k.fgpt, k.bidx1);
+        if (segment->_packed)
+            segment->unpack();
+        bool r = insert((int) k.hashfrag, k.fgpt, seg_idx, segment, k.bidx1,
+            bidx2);
+        if (r && _tracks_load())
+            _note_load(segment, seg_idx, 1);
+        inserted += r;
+    }
+    return inserted;
+}
+
+
+bool Bamboo::_defer(u32 seg_idx, u32 bi_main, u32 bi_alt, u32 fgpt, 
+        u32 fgpt_cnt)
+{
+    _build_group->deferred.push_back({fgpt, fgpt_cnt, bi_main, bi_alt, 
+        seg_idx & ((1u << _seg_idx_base) - 1)});
+    return true;
+}
+
+
+/* Build workers share the filter, so each group draws from its own 
+ * generator */
+u32 Bamboo::_victim_slot()
+{
+    if (_build)
+        return _build_group->rng.below(_fgpt_per_bucket);
+    return _rng.below(_fgpt_per_bucket);
+}
+
+
+/* Expands the filter by adding a new segment and relocating fingerprints
+ * based on "partial-key linear hashing". */
+bool Bamboo::overflow(Segment *segment, u32 seg_idx, u32 bidx1, u32 bidx2, 
+        u32 fgpt, u32 fgpt_cnt)
+{
+    std::chrono::_V2::high_resolution_clock::time_point t1,t2;
+    std::chrono::_V2::system_clock::duration ns;
+
+    if (_build)
+        return _defer(seg_idx, bidx1, bidx2, fgpt, fgpt_cnt);
+
+    t1 = std::chrono::high_resolution_clock::now();
+
+    ++stats._expand_count;
+    Segment *new_segment = split(segment, seg_idx);
+    int expansion_count = segment->expansion_count;
+    u32 new_idx = seg_idx | (1 << (expansion_count + _seg_idx_base - 1));
+
     if (1<<(expansion_count - 1) & fgpt) {
         segment = new_segment;
         seg_idx = new_idx;
     }
+    segment->settle(bidx1);
+    segment->settle(bidx2);
     // cout << "After expand: occupancy = " << occupancy() << endl;
-    ++_num_segments;
 
-    bool r = !segment->buckets[bidx1].insert_fgpt_count(fgpt, fgpt_cnt) 
-        || !segment->buckets[bidx2].insert_fgpt_count(fgpt, fgpt_cnt)
+    bool r = !segment->bucket(bidx1).insert_fgpt_count(fgpt, fgpt_cnt) 
+        || !segment->bucket(bidx2).insert_fgpt_count(fgpt, fgpt_cnt)
         || _cuckoo(segment, seg_idx, bidx1, bidx2, fgpt, fgpt_cnt, 1);
 
     t2 = std::chrono::high_resolution_clock::now();
@@ -406,28 +1335,35 @@ void BambooOverflow::expand(int seg_idx)
     Segment *new_seg = 
         new Segment(1 << _bucket_idx_len, _fgpt_size, _fgpt_per_bucket, 0);
     for (int i = 0; i < (1 << _bucket_idx_len); i++) 
-        base_seg->buckets[i].split_bucket(new_seg->buckets[i], 0);
-
+        base_seg->bucket(i).split_bucket(new_seg->bucket(i), _expand_base);
+
+    /* Drain the stashes and the overflow chain into the two halves */
+    auto reinsert = [&](u32 i, u32 fgpt, u32 fgpt_cnt) {
+        Segment *insert_segment = (1<<_expand_base) & fgpt ? new_seg : base_seg;
+        u32 bidx2 = _alt_bucket(fgpt, i);
+        !insert_segment->bucket(i).insert_fgpt_count(fgpt, fgpt_cnt)
+            || !insert_segment->bucket(bidx2).insert_fgpt_count(fgpt, fgpt_cnt)
+            || _cuckoo(insert_segment, seg_idx, i, bidx2, fgpt, fgpt_cnt, 1);
+    };
+    auto unstash = [&](u32 bidx, u32 entry) {
+        reinsert(bidx, entry >> 1, (entry & 1) + 1);
+    };
     Segment *overflow = base_seg->overflow;
+    Segment *drained;
     base_seg->overflow = nullptr;
-    u32 fgpt, fgpt_cnt;
+    base_seg->drain_stash(unstash);
     while(overflow)
     {
-        for (int i = 0; i < (1 << _bucket_idx_len); i++) 
+        for (u32 i = 0; i < (1u << _bucket_idx_len); i++) 
         {   
-            vector<vector<u32>> fgpts = overflow->buckets[i].retrieve_all();
-            for(vector<u32> data : fgpts)
-            {
-                fgpt = data[0];
-                fgpt_cnt = data[1];
-                Segment *insert_segment = (1<<_expand_base) & fgpt ? new_seg : base_seg;
-                u32 bidx2 = _alt_bucket(fgpt, i);
-                insert_segment->buckets[i].insert_fgpt_count(fgpt, fgpt_cnt)
-                    || insert_segment->buckets[bidx2].insert_fgpt_count(fgpt, fgpt_cnt)
-                    || _cuckoo(insert_segment, seg_idx, i, bidx2, fgpt, fgpt_cnt, 1);
-            }
+            overflow->bucket(i).for_each([&](u32 fgpt, u32 fgpt_cnt) {
+                reinsert(i, fgpt, fgpt_cnt);
+            });
         }
+        overflow->drain_stash(unstash);
+        drained = overflow;
         overflow = overflow->overflow;
+        delete drained;
     }
     _segments.push_back(new_seg);
 
@@ -437,6 +1373,25 @@ void BambooOverflow::expand(int seg_idx)
 
 }
 
+void BambooOverflow::reserve(u64 expected_items, double target_load)
+{
+    OpGuard guard(_op_mutex);
+    /* Segments not yet split in the current round take twice the hashes
+     * of the split ones, so only whole rounds keep all at *target_load* */
+    u64 segments = 1ull << _reserve_depth(expected_items, target_load);
+
+    u64 added = 0;
+    while (_segments.size() < segments) {
+        _expand_next();
+        ++added;
+    }
+    /* The insert schedule would have added these segments over the next
+     * *added* prompts; start counting after them */
+    _insert_count -= (int) std::min<u64>(added * _expand_prompt, 
+        INT32_MAX / 2);
+}
+
+
 /* Inserts or removes an elt until it has the desired *cnt*. */
 void BambooBase::adjust_to(int elt, int cnt)
 {
@@ -449,38 +1404,50 @@ void BambooBase::adjust_to(int elt, int cnt)
 bool BambooBase::_extract(int elt, u32 &fgpt, u32 &seg_idx, Segment *&segment, 
         u32 &bidx1, u32 &bidx2)
 {
-    u32 hash = _compute_hash(elt);
-    fgpt = (hash >> (_bucket_idx_len + _seg_idx_base)) & ((1<<_fgpt_size) - 1);
-    
-    /* Rehash if the fingerprint is all zeros */
-    if (!fgpt) {
-        return _extract(hash, fgpt, seg_idx, segment, bidx1, bidx2);
-    }
-    segment = _get_segment(hash >> _bucket_idx_len, seg_idx);
-    bidx1 = hash & _bucket_mask;
+    u32 hashfrag;
+    _route(elt, fgpt, hashfrag, bidx1);
+    segment = _get_segment(hashfrag, seg_idx);
     bidx2 = _alt_bucket(fgpt, bidx1);
     return true;
 }
 
 
-u32 count_helper(BitTrie *node)
+/* _extract() from a 64-bit hash: used by hash-once mode, hash policies
+ * other than HASH_SPOOKY, and the u64, string and hashed-key APIs. The
+ * hash is laid out as | fgpt | segment prefix | bucket index | from the
+ * low bits, like the 32-bit one. An all-zero fgpt is replaced by its top
+ * bit rather than rehashing: segments split on fgpt bits below 
+ * *_fgpt_size - 1* only, so the routing of the other keys is unaffected. */
+bool BambooBase::_extract_hash(u64 hash, u32 &fgpt, u32 &seg_idx, 
+        Segment *&segment, u32 &bidx1, u32 &bidx2)
 {
-    if (!node)
-        return 0;
-    u32 tot = 0;
-    if (node->ptr)
-        tot += node->ptr->occupancy();
-    tot += count_helper(node->zero);
-    tot += count_helper(node->one);
+    u32 hashfrag;
+    _route_hash(hash, fgpt, hashfrag, bidx1);
+    segment = _get_segment(hashfrag, seg_idx);
+    bidx2 = _alt_bucket(fgpt, bidx1);
+    return true;
+}
 
-    return tot;
+
+bool Bamboo::pack()
+{
+    bool r = true;
+    _finish_splits();
+    for_each_segment([&](Segment *segment, u32) {
+        r = segment->pack() && r;
+    });
+    return r;
 }
 
 
 /* Computes the number of fingerprints stored */
 u32 Bamboo::occupancy()
 {
-    return count_helper(_trie_head);
+    u32 tot = 0;
+    for_each_segment([&](Segment *segment, u32) {
+        tot += segment->occupancy();
+    });
+    return tot;
 }
 
 /* Returns the total number of fingerprints that can be stored. */
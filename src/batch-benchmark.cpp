@@ -0,0 +1,103 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Lookup throughput of one count() per key against count_batch() and
+ * contains_batch(), on filters from cache-sized to well past the last
+ * level cache. The batch calls get the keys in chunks, the way a caller
+ * with a stream of lookups would hand them over. */
+
+volatile u64 sink;
+
+double ops_per_us(std::chrono::_V2::high_resolution_clock::time_point t1,
+        u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+void bench_lookups(const char *name, Bamboo *bbf, vector<u64> &keys,
+        size_t chunk)
+{
+    vector<u32> counts(chunk);
+    bool *found = new bool[chunk];
+    u64 sum = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (u64 key : keys)
+        sum += bbf->count(key);
+    double scalar = ops_per_us(t1, keys.size());
+    u64 sum_scalar = sum;
+
+    sum = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < keys.size(); i += chunk) {
+        size_t n = std::min(chunk, keys.size() - i);
+        bbf->count_batch(&keys[i], n, counts.data());
+        for (size_t j = 0; j < n; ++j)
+            sum += counts[j];
+    }
+    double batch = ops_per_us(t1, keys.size());
+    u64 sum_batch = sum;
+
+    u64 hits = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < keys.size(); i += chunk) {
+        size_t n = std::min(chunk, keys.size() - i);
+        bbf->contains_batch(&keys[i], n, found);
+        for (size_t j = 0; j < n; ++j)
+            hits += found[j];
+    }
+    double contains = ops_per_us(t1, keys.size());
+
+    cout << "   " << name
+        << " :: count() " << std::setw(6) << scalar << " M/s"
+        << " :: count_batch " << std::setw(6) << batch << " M/s"
+        << " :: contains_batch " << std::setw(6) << contains << " M/s"
+        << " :: speedup " << batch / scalar;
+    if (sum_scalar != sum_batch)
+        cout << " ** counts differ **";
+    cout << endl;
+    sink += sum + hits;
+    delete[] found;
+}
+
+
+void bench_size(u64 num_elements, size_t chunk)
+{
+    Bamboo *bbf = make_bamboo(8, 15, 8, 4, 0, 1, 2);
+    std::mt19937_64 gen(num_elements);
+    vector<u64> keys(num_elements);
+    for (u64 &k : keys)
+        k = gen();
+    bbf->build(keys.data(), keys.size(), 1);
+
+    size_t lookups = 8000000;
+    vector<u64> positives(lookups), negatives(lookups);
+    for (size_t i = 0; i < lookups; ++i) {
+        positives[i] = keys[gen() % num_elements];
+        negatives[i] = gen();
+    }
+
+    cout << "items " << num_elements << " segments " << bbf->_num_segments
+        << " filter " << (u64) bbf->capacity() * 2 / (1 << 20) << " MB"
+        << " chunk " << chunk << endl;
+    bench_lookups("hits  ", bbf, positives, chunk);
+    bench_lookups("misses", bbf, negatives, chunk);
+    delete bbf;
+}
+
+
+int main()
+{
+    cout << std::setprecision(2) << std::fixed;
+    for (u64 num_elements : {1000000ull, 16000000ull, 64000000ull})
+        bench_size(num_elements, 1024);
+    bench_size(64000000ull, 64);
+}
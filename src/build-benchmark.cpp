@@ -0,0 +1,95 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+using std::cout, std::endl;
+
+/* Time to fill a Bamboo from an array of u64 keys: an insert() loop, the
+ * same after reserve(), and Bamboo::build() by thread count, also at a
+ * higher target load. Every filter must answer the same counts as the
+ * insert() loop. */
+
+double secs_since(std::chrono::_V2::high_resolution_clock::time_point t1)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e9;
+}
+
+
+void report(const char *name, double secs, size_t n, Bamboo *bbf, 
+        Bamboo *ref, vector<u64> &probes)
+{
+    int diff = 0;
+    for (u64 key : probes)
+        diff += bbf->count(key) != ref->count(key);
+    cout << std::setw(14) << name
+        << " :: " << std::setw(6) << secs << " s"
+        << " :: " << std::setw(6) << n / secs / 1e6 << " M/s"
+        << " :: segments " << std::setw(6) << bbf->_num_segments
+        << " :: load " << (double) bbf->occupancy() / bbf->capacity();
+    if (diff)
+        cout << " ** " << diff << " differing counts **";
+    cout << endl;
+}
+
+
+int main()
+{
+    size_t n = 16000000;
+    int bucket_idx_len = 8, fgpt_size = 15, fgpt_per_bucket = 8;
+    int seg_idx_base = 4;
+    std::mt19937_64 gen(0);
+    vector<u64> keys(n);
+    for (u64 &k : keys)
+        k = gen();
+    /* Half hits, half (mostly) misses */
+    vector<u64> probes;
+    for (size_t i = 0; i < n; i += 16) {
+        probes.push_back(keys[i]);
+        probes.push_back(gen());
+    }
+
+    cout << std::setprecision(3) << std::fixed;
+    cout << "hardware threads " << std::thread::hardware_concurrency()
+        << " :: keys " << n << endl;
+
+    auto make = [&]() {
+        return make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+            seg_idx_base, 0, 1, 2);
+    };
+    Bamboo *ref = make();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (u64 k : keys)
+        ref->insert(k);
+    report("insert loop", secs_since(t1), n, ref, ref, probes);
+
+    Bamboo *bbf = make();
+    t1 = std::chrono::high_resolution_clock::now();
+    bbf->reserve(n);
+    for (u64 k : keys)
+        bbf->insert(k);
+    report("reserve+loop", secs_since(t1), n, bbf, ref, probes);
+    delete bbf;
+
+    int max_threads = std::max(8u, std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        bbf = make();
+        t1 = std::chrono::high_resolution_clock::now();
+        bbf->build(keys.data(), n, threads);
+        std::string name = "build " + std::to_string(threads);
+        report(name.c_str(), secs_since(t1), n, bbf, ref, probes);
+        delete bbf;
+    }
+
+    /* Without the headroom of reserve(), at the size the loop reaches */
+    bbf = make();
+    t1 = std::chrono::high_resolution_clock::now();
+    bbf->build(keys.data(), n, max_threads, 1.0);
+    report("build load 1", secs_since(t1), n, bbf, ref, probes);
+    delete bbf;
+    delete ref;
+}
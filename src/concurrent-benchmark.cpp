@@ -0,0 +1,118 @@
+#include "include/bamboo.hpp"
+#include "include/concurrent.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+
+using std::cout, std::endl;
+
+/* Mixed read/write throughput of ConcurrentBamboo from 1 to N threads.
+ * Each configuration starts from a filter holding *prefill* keys; threads
+ * then look up prefilled keys and insert fresh ones at the given write
+ * ratio, so writes keep splitting segments under the readers. Lookups of
+ * prefilled keys must never miss, which checks the optimistic reads. The
+ * first line of each mix is a plain Bamboo on one thread, the cost of the
+ * locking. */
+
+std::atomic<u64> sink;
+
+struct RunResult {
+    double mops;
+    u64 misses;
+    u64 missing;
+};
+
+
+/* A cheap per-thread sequence to pick reads and keys */
+inline u64 _next(u64 &s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+
+RunResult run_mix(BambooBase *bbf, int threads, int prefill, u64 ops, 
+        int write_pct)
+{
+    for (int i = 0; i < prefill; ++i)
+        bbf->insert(i);
+
+    std::atomic<u64> misses(0);
+    vector<std::thread> workers;
+    u64 per_thread = ops / threads;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            u64 s = 0x9E3779B97F4A7C15ull * (t + 1);
+            int next_key = prefill + t * (int) per_thread;
+            u64 miss = 0, hits = 0;
+            for (u64 i = 0; i < per_thread; ++i) {
+                u64 r = _next(s);
+                if ((int) (r % 100) < write_pct) {
+                    bbf->insert(next_key++);
+                } else {
+                    int c = bbf->count((int) ((r >> 8) % prefill));
+                    miss += !c;
+                    hits += c;
+                }
+            }
+            misses += miss;
+            sink += hits;
+        });
+    }
+    for (std::thread &w : workers)
+        w.join();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    double secs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e9;
+
+    /* Every insert has returned, all keys must be found */
+    u64 missing = 0;
+    for (int i = 0; i < prefill; ++i)
+        missing += !bbf->count(i);
+    for (int t = 0; t < threads; ++t) {
+        int first = prefill + t * (int) per_thread;
+        for (u64 i = 0; i < per_thread * write_pct / 100 / 2; ++i)
+            missing += !bbf->count(first + (int) i);
+    }
+    delete bbf;
+    return {per_thread * threads / secs / 1e6, misses, missing};
+}
+
+
+int main()
+{
+    int prefill = 1000000;
+    u64 ops = 8000000;
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    cout << std::setprecision(2) << std::fixed;
+    cout << "hardware threads " << std::thread::hardware_concurrency() 
+        << " :: prefill " << prefill << " :: ops " << ops << endl;
+
+    for (int write_pct : {0, 10, 50}) {
+        cout << "writes " << write_pct << "%" << endl;
+        RunResult base = run_mix(new Bamboo(8, 15, 8, 4, 0, 1, 2), 1, 
+            prefill, ops, write_pct);
+        cout << "   Bamboo       1 thread  :: " << std::setw(6) << base.mops 
+            << " Mops/s" << endl;
+        double single = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            RunResult r = run_mix(new ConcurrentBamboo(8, 15, 8, 4, 1, 2), 
+                threads, prefill, ops, write_pct);
+            if (threads == 1)
+                single = r.mops;
+            cout << "   Concurrent " << std::setw(2) << threads 
+                << (threads == 1 ? " thread  :: " : " threads :: ")
+                << std::setw(6) << r.mops << " Mops/s :: speedup " 
+                << r.mops / single;
+            if (r.misses || r.missing)
+                cout << " ** " << r.misses << " missed lookups, " 
+                    << r.missing << " false negatives **";
+            cout << endl;
+        }
+    }
+}
@@ -0,0 +1,280 @@
+#include <thread>
+#include "include/concurrent.hpp"
+
+/* Concurrent Bamboo */
+
+
+/* Bumps *seq* to odd for the lifetime of the guard, also when the write
+ * throws, so that readers never wait forever */
+struct SeqWrite {
+    std::atomic<u64> &seq;
+    SeqWrite(std::atomic<u64> &seq) : seq(seq)
+    {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, 
+            std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    ~SeqWrite()
+    {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, 
+            std::memory_order_release);
+    }
+};
+
+
+ConcurrentBamboo::ConcurrentBamboo(int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base) :
+            Bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base),
+            _stripes(new LockStripe[STRIPES]),
+            _version(0),
+            _reader_dir(nullptr)
+{
+    _victim_seed = _rng.next();
+    _publish_directory();
+}
+
+
+ConcurrentBamboo::ConcurrentBamboo(int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base, u32 seed, u32 alt_seed) :
+            Bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base,
+                seed, alt_seed),
+            _stripes(new LockStripe[STRIPES]),
+            _version(0),
+            _reader_dir(nullptr)
+{
+    _victim_seed = _rng.next();
+    _publish_directory();
+}
+
+
+ConcurrentBamboo::~ConcurrentBamboo()
+{
+    delete[] _stripes;
+    for (std::atomic<Segment*> *dir : _retired_dirs)
+        delete[] dir;
+    delete[] _reader_dir.load();
+}
+
+
+/* Replaces the reader directory by a copy of _directory. The old copy is
+ * retired rather than freed */
+void ConcurrentBamboo::_publish_directory()
+{
+    std::atomic<Segment*> *dir = new std::atomic<Segment*>[_directory.size()];
+    for (u32 i = 0; i < _directory.size(); ++i)
+        dir[i].store(_directory[i], std::memory_order_relaxed);
+    if (_reader_dir.load(std::memory_order_relaxed))
+        _retired_dirs.push_back(_reader_dir.load(std::memory_order_relaxed));
+    _reader_dir.store(dir, std::memory_order_release);
+    _reader_mask.store(_dir_mask, std::memory_order_release);
+    _reader_dir_size = _directory.size();
+}
+
+
+/* Under *_split_mutex*, or on a quiescent filter */
+void ConcurrentBamboo::_set_segment(u32 seg_idx, u32 depth, 
+        Segment *segment)
+{
+    Bamboo::_set_segment(seg_idx, depth, segment);
+    if (_directory.size() != _reader_dir_size) {
+        _publish_directory();
+        return;
+    }
+    std::atomic<Segment*> *dir = _reader_dir.load(std::memory_order_relaxed);
+    for (u32 i = seg_idx; i < _directory.size(); i += 1 << depth)
+        dir[i].store(segment, std::memory_order_relaxed);
+}
+
+
+int ConcurrentBamboo::shrink()
+{
+    int merges = Bamboo::shrink();
+    _publish_directory();
+    return merges;
+}
+
+
+template <typename Extract>
+int ConcurrentBamboo::_read(Extract extract)
+{
+    u32 fgpt, bidx1, bidx2, seg_idx;
+    Segment *segment;
+    for (;;) {
+        u64 version = _version.load(std::memory_order_acquire);
+        if (version & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!extract(fgpt, seg_idx, segment, bidx1, bidx2))
+            return 0;
+        LockStripe &stripe = _stripes[seg_idx & (STRIPES - 1)];
+        u64 seq = stripe.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        int count = _count_extracted(fgpt, segment, bidx1, bidx2);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (stripe.seq.load(std::memory_order_relaxed) == seq
+                && _version.load(std::memory_order_relaxed) == version)
+            return count;
+    }
+}
+
+
+template <typename Extract, typename Op>
+bool ConcurrentBamboo::_write(Extract extract, Op op)
+{
+    u32 fgpt, bidx1, bidx2, seg_idx;
+    Segment *segment;
+    for (;;) {
+        u64 version = _version.load(std::memory_order_acquire);
+        if (version & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!extract(fgpt, seg_idx, segment, bidx1, bidx2))
+            return false;
+        LockStripe &stripe = _stripes[seg_idx & (STRIPES - 1)];
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        /* A split since the lookup may have moved the key. None can start
+         * on this segment while its stripe is held */
+        if (_version.load(std::memory_order_acquire) != version)
+            continue;
+        SeqWrite write(stripe.seq);
+        return op(fgpt, seg_idx, segment, bidx1, bidx2);
+    }
+}
+
+
+/* The key API */
+
+int ConcurrentBamboo::count(int elt)
+{
+    return _read([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract(elt, fgpt, seg_idx, segment, bidx1, bidx2);
+    });
+}
+
+bool ConcurrentBamboo::insert(int elt)
+{
+    return _write([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract(elt, fgpt, seg_idx, segment, bidx1, bidx2);
+    }, [&](u32 fgpt, u32 seg_idx, Segment *segment, u32 bidx1, u32 bidx2) {
+        return insert(elt, fgpt, seg_idx, segment, bidx1, bidx2);
+    });
+}
+
+bool ConcurrentBamboo::remove(int elt)
+{
+    return _write([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract(elt, fgpt, seg_idx, segment, bidx1, bidx2);
+    }, [&](u32 fgpt, u32 seg_idx, Segment *segment, u32 bidx1, u32 bidx2) {
+        return _remove_extracted(fgpt, segment, bidx1, bidx2);
+    });
+}
+
+int ConcurrentBamboo::count_hash(u64 hash)
+{
+    return _read([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    });
+}
+
+bool ConcurrentBamboo::contains(int elt)
+{
+    return count(elt) > 0;
+}
+
+bool ConcurrentBamboo::contains_hash(u64 hash)
+{
+    return count_hash(hash) > 0;
+}
+
+void ConcurrentBamboo::count_batch(const int *keys, size_t n, u32 *counts)
+{
+    for (size_t i = 0; i < n; ++i)
+        counts[i] = count(keys[i]);
+}
+
+void ConcurrentBamboo::count_batch(const u64 *keys, size_t n, u32 *counts)
+{
+    for (size_t i = 0; i < n; ++i)
+        counts[i] = count(keys[i]);
+}
+
+void ConcurrentBamboo::contains_batch(const int *keys, size_t n, 
+        bool *found)
+{
+    for (size_t i = 0; i < n; ++i)
+        found[i] = count(keys[i]) > 0;
+}
+
+void ConcurrentBamboo::contains_batch(const u64 *keys, size_t n, 
+        bool *found)
+{
+    for (size_t i = 0; i < n; ++i)
+        found[i] = count(keys[i]) > 0;
+}
+
+size_t ConcurrentBamboo::insert_batch(const int *keys, size_t n)
+{
+    size_t inserted = 0;
+    for (size_t i = 0; i < n; ++i)
+        inserted += insert(keys[i]);
+    return inserted;
+}
+
+size_t ConcurrentBamboo::insert_batch(const u64 *keys, size_t n)
+{
+    size_t inserted = 0;
+    for (size_t i = 0; i < n; ++i)
+        inserted += insert(keys[i]);
+    return inserted;
+}
+
+bool ConcurrentBamboo::insert_hash(u64 hash)
+{
+    return _write([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    }, [&](u32 fgpt, u32 seg_idx, Segment *segment, u32 bidx1, u32 bidx2) {
+        return insert((int) hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    });
+}
+
+bool ConcurrentBamboo::remove_hash(u64 hash)
+{
+    return _write([&](u32 &fgpt, u32 &seg_idx, Segment *&segment, 
+            u32 &bidx1, u32 &bidx2) {
+        return _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    }, [&](u32 fgpt, u32 seg_idx, Segment *segment, u32 bidx1, u32 bidx2) {
+        return _remove_extracted(fgpt, segment, bidx1, bidx2);
+    });
+}
+
+
+/* Runs with the stripe of *segment* held. The insert that follows the
+ * split may overflow again, hence the recursive mutex */
+bool ConcurrentBamboo::overflow(Segment *segment, u32 seg_idx, u32 bi_main,
+        u32 bi_alt, u32 fgpt, u32 fgpt_cnt)
+{
+    std::lock_guard<std::recursive_mutex> lock(_split_mutex);
+    if (_version.load(std::memory_order_relaxed) & 1)
+        return Bamboo::overflow(segment, seg_idx, bi_main, bi_alt, fgpt, 
+            fgpt_cnt);
+    SeqWrite write(_version);
+    return Bamboo::overflow(segment, seg_idx, bi_main, bi_alt, fgpt, 
+        fgpt_cnt);
+}
+
+
+/* The filter's own generator would be shared by the writers */
+u32 ConcurrentBamboo::_victim_slot()
+{
+    return thread_rand(_victim_seed).below(_fgpt_per_bucket);
+}
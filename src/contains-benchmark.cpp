@@ -0,0 +1,89 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <unordered_set>
+
+using std::cout, std::endl;
+
+/* Membership throughput of count() > 0 against contains(), which stops at
+ * the first bucket or segment holding the fgpt. Positive lookups gain the
+ * most, and on BambooOverflow, whose overflow chains count() walks to the
+ * end. Also checks that both give the same answers. */
+
+volatile u64 sink;
+
+double ops_per_us(std::chrono::_V2::high_resolution_clock::time_point t1,
+        u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+void bench_contains(const char *name, BambooBase *bbf, vector<int> &keys,
+        vector<int> &negatives)
+{
+    for (int key : keys)
+        bbf->insert(key);
+
+    cout << std::setw(10) << name << " items " << std::setw(8) << keys.size();
+    int differ = 0;
+    for (vector<int> *lookups : {&keys, &negatives}) {
+        u64 by_count = 0, by_contains = 0;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (int key : *lookups)
+            by_count += bbf->count(key) > 0;
+        double counts = ops_per_us(t1, lookups->size());
+
+        t1 = std::chrono::high_resolution_clock::now();
+        for (int key : *lookups)
+            by_contains += bbf->contains(key);
+        double contains = ops_per_us(t1, lookups->size());
+
+        differ += by_count != by_contains;
+        cout << (lookups == &keys ? " :: hits " : " :: misses ")
+            << "count>0 " << std::setw(6) << counts << " -> contains "
+            << std::setw(6) << contains << " M/s";
+        sink += by_count + by_contains;
+    }
+    if (differ)
+        cout << " ** answers differ **";
+    cout << endl;
+    delete bbf;
+}
+
+
+int main()
+{
+    int num_elements = 4000000;
+    int num_negatives = 4000000;
+    std::mt19937 gen(0);
+    std::unordered_set<int> seen;
+    vector<int> keys, negatives;
+    while ((int) keys.size() < num_elements) {
+        int key = gen();
+        if (seen.insert(key).second)
+            keys.push_back(key);
+    }
+    while ((int) negatives.size() < num_negatives) {
+        int key = gen();
+        if (!seen.count(key))
+            negatives.push_back(key);
+    }
+
+    cout << std::setprecision(2) << std::fixed;
+    for (int fgpt_per_bucket : {4, 8}) {
+        cout << "fgpt_size 15 slots " << fgpt_per_bucket << endl;
+        bench_contains("fixed", make_bamboo(8, 15, fgpt_per_bucket, 4,
+            0, 1, 2), keys, negatives);
+        bench_contains("runtime", new Bamboo(8, 15, fgpt_per_bucket, 4,
+            1, 2), keys, negatives);
+        /* BambooOverflow is slow to fill, see reserve() */
+        vector<int> sub(keys.begin(), keys.begin() + num_elements / 20);
+        bench_contains("overflow", new BambooOverflow(8, 15,
+            fgpt_per_bucket, 4), sub, negatives);
+    }
+}
@@ -0,0 +1,77 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Random-walk cuckoo insertion against the breadth-first path search (see
+ * BambooBase::_bfs_cuckoo): insert throughput, entries moved per insert,
+ * the load the filter reaches before its first split and the slowest
+ * insert. */
+
+void bench_cuckoo(int fgpt_per_bucket, u32 chain_max, bool bfs,
+        vector<int> &keys)
+{
+    int bucket_idx_len = 8;
+    int fgpt_size = 15;
+    int seg_idx_base = 4;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    bbf->_chain_max = chain_max;
+    bbf->_bfs_cuckoo = bfs;
+
+    double first_split_load = 0;
+    u32 worst = 0;
+    std::chrono::_V2::high_resolution_clock::time_point t0, t1, t2;
+    t0 = std::chrono::high_resolution_clock::now();
+    for (int key : keys) {
+        if (!bbf->stats._expand_count)
+            first_split_load = (double) bbf->occupancy() / bbf->capacity();
+        t1 = std::chrono::high_resolution_clock::now();
+        bbf->insert(key);
+        t2 = std::chrono::high_resolution_clock::now();
+        worst = std::max<u32>(worst, 
+            std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+    }
+    double secs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t0).count() / 1e9;
+
+    int missing = 0;
+    for (int key : keys)
+        missing += !bbf->count(key);
+
+    cout << std::setw(6) << (bfs ? "bfs" : "walk")
+        << " slots " << fgpt_per_bucket
+        << " chain_max " << std::setw(3) << chain_max
+        << " :: insert " << std::setw(6) << keys.size() / secs / 1e6 << " M/s"
+        << " :: moves/insert " << std::setw(6)
+        << (double) bbf->stats._counter0 / keys.size()
+        << " :: overflows " << std::setw(6) << bbf->stats._counter1
+        << " :: first split at load " << first_split_load
+        << " :: load " << (double) bbf->occupancy() / bbf->capacity()
+        << " :: max " << std::setw(7) << worst / 1000 << " us";
+    if (missing)
+        cout << " ** " << missing << " false negatives **";
+    cout << endl;
+    delete bbf;
+}
+
+
+int main()
+{
+    srand(0);
+    int num_elements = 2000000;
+    std::mt19937 gen(0);
+    vector<int> keys(num_elements);
+    for (int &k : keys)
+        k = gen();
+
+    cout << std::setprecision(3) << std::fixed;
+    for (int fgpt_per_bucket : {2, 4, 8})
+        for (u32 chain_max : {64, 500})
+            for (bool bfs : {false, true})
+                bench_cuckoo(fgpt_per_bucket, chain_max, bfs, keys);
+}
@@ -0,0 +1,101 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Segment lookup latency of the extendible hashing directory of Bamboo
+ * against the BitTrie it replaced. The trie is rebuilt from the directory
+ * of a filled filter, so both route the same hashes to the same segments.
+ * Also reports the latency of a whole count(). */
+
+volatile u64 sink;
+
+double ns_per_op(std::chrono::_V2::high_resolution_clock::time_point t1,
+        u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / ops;
+}
+
+
+void bench_directory(u64 num_elements)
+{
+    int bucket_idx_len = 8;
+    int fgpt_size = 15;
+    int fgpt_per_bucket = 8;
+    int seg_idx_base = 4;
+    int lookups = 10000000;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+
+    std::mt19937 gen(0);
+    for (u64 i = 0; i < num_elements; ++i)
+        bbf->insert((int) gen());
+
+    BitTrie *trie = new BitTrie();
+    bbf->for_each_segment([&](Segment *segment, u32 seg_idx) {
+        trie->insert(seg_idx, bbf->_local_depth(segment), segment);
+    });
+
+    /* Random hash fragments, as _extract() would pass them */
+    vector<u32> frags(1 << 20);
+    for (u32 &f : frags)
+        f = gen() >> bucket_idx_len;
+    u32 fmask = frags.size() - 1;
+
+    u64 sum = 0;
+    u32 seg_idx, depth;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        depth = 0;
+        Segment *s = trie->retrieve(frags[i & fmask], depth);
+        seg_idx = frags[i & fmask] & ((1 << depth) - 1);
+        sum += (u64) s + seg_idx;
+    }
+    double ns_trie = ns_per_op(t1, lookups);
+
+    u64 sum_trie = sum;
+    sum = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        Segment *s = bbf->_get_segment(frags[i & fmask], seg_idx);
+        sum += (u64) s + seg_idx;
+    }
+    double ns_dir = ns_per_op(t1, lookups);
+    u64 sum_dir = sum;
+
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        sum += bbf->count((int) gen());
+    double ns_count = ns_per_op(t1, lookups);
+
+    cout << "items " << std::setw(9) << num_elements
+        << " segments " << std::setw(7) << bbf->_num_segments
+        << " global depth " << bbf->_global_depth
+        << " :: trie " << std::setw(6) << ns_trie << " ns"
+        << " :: directory " << std::setw(6) << ns_dir << " ns"
+        << " :: count() " << std::setw(6) << ns_count << " ns";
+    if (sum_trie != sum_dir)
+        cout << " ** routing mismatch **";
+    cout << endl;
+    sink += sum;
+
+    /* The filter owns the segments */
+    bbf->for_each_segment([&](Segment *segment, u32 seg_idx) {
+        trie->clear(seg_idx, bbf->_local_depth(segment));
+    });
+    delete trie;
+    delete bbf;
+}
+
+
+int main()
+{
+    cout << std::setprecision(2) << std::fixed;
+    for (u64 num_elements : {1000000ull, 10000000ull, 100000000ull})
+        bench_directory(num_elements);
+}
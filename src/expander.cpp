@@ -0,0 +1,56 @@
+#include "include/expander.hpp"
+
+/* Background expansion */
+
+
+BackgroundExpander::BackgroundExpander(BambooBase *filter) :
+        _filter(filter),
+        _pending(false),
+        _stop(false)
+{
+    /* Attached first, so that _init_load() queues the segments that
+     * already need a split */
+    _filter->_op_mutex = &_mutex;
+    _filter->_expander = this;
+    _filter->_init_load();
+    _worker = std::thread(&BackgroundExpander::_run, this);
+}
+
+
+BackgroundExpander::~BackgroundExpander()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _worker.join();
+
+    _filter->_expander = nullptr;
+    _filter->_op_mutex = nullptr;
+    while (_filter->_background_step())
+        ;
+}
+
+
+void BackgroundExpander::notify()
+{
+    _pending = true;
+    _cv.notify_one();
+}
+
+
+void BackgroundExpander::_run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+        _cv.wait(lock, [this] { return _pending || _stop; });
+        _pending = false;
+        while (!_stop && _filter->_background_step()) {
+            /* Let the key API in between steps */
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+}
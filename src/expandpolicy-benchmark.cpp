@@ -0,0 +1,112 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <unordered_set>
+
+using std::cout, std::endl;
+
+/* Sweeps the expansion policies of Bamboo (see ExpandPolicy): insert 
+ * throughput, memory per item and the measured false positive rate once
+ * all keys are in. Load and memory go through a sawtooth as segments 
+ * split, so both are averaged over checkpoints every 1/8 of the keys. */
+
+volatile u64 sink;
+
+struct PolicyConfig {
+    const char *name;
+    ExpandPolicy policy;
+    u32 chain_max;
+    double expand_load;
+};
+
+
+void bench_policy(int fgpt_per_bucket, PolicyConfig &config, 
+        vector<int> &keys, vector<int> &negatives)
+{
+    int bucket_idx_len = 8;
+    int fgpt_size = 15;
+    int seg_idx_base = 4;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    bbf->_expand_policy = config.policy;
+    bbf->_chain_max = config.chain_max;
+    bbf->_expand_load = config.expand_load;
+
+    u64 ns = 0;
+    double load = 0, bytes = 0;
+    int checkpoints = 8;
+    size_t step = keys.size() / checkpoints;
+    for (size_t from = 0; from < keys.size(); from += step) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (size_t i = from; i < from + step; ++i)
+            bbf->insert(keys[i]);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t2 - t1).count();
+
+        /* Slab bytes; the directory adds a pointer per entry */
+        u64 b = bbf->_directory.size() * sizeof(Segment*);
+        bbf->for_each_segment([&](Segment *segment, u32) {
+            b += (u64) segment->num_buckets * segment->_bucket_len;
+        });
+        bytes += (double) b / (from + step) / checkpoints;
+        load += (double) bbf->occupancy() / bbf->capacity() / checkpoints;
+    }
+    double inserts = keys.size() / (ns / 1e3);
+
+    u64 hits = 0, fp = 0;
+    for (int key : keys)
+        hits += bbf->count(key) > 0;
+    for (int key : negatives)
+        fp += bbf->count(key) > 0;
+
+    cout << "slots " << std::setw(2) << fgpt_per_bucket
+        << " " << std::setw(14) << config.name
+        << " :: insert " << std::setw(6) << inserts << " M/s"
+        << " :: avg " << std::setw(6) << bytes << " bytes/item"
+        << " :: avg load " << load
+        << " :: FPR " << std::setprecision(6) 
+        << (double) fp / negatives.size() << std::setprecision(3);
+    if (hits != keys.size())
+        cout << " ** " << keys.size() - hits << " false negatives **";
+    cout << endl;
+    sink += hits + fp;
+    delete bbf;
+}
+
+
+int main()
+{
+    int num_elements = 4000000;   /* A multiple of 8 */
+    int num_negatives = 4000000;
+    std::mt19937 gen(0);
+    std::unordered_set<int> seen;
+    vector<int> keys, negatives;
+    while ((int) keys.size() < num_elements) {
+        int key = gen();
+        if (seen.insert(key).second)
+            keys.push_back(key);
+    }
+    while ((int) negatives.size() < num_negatives) {
+        int key = gen();
+        if (!seen.count(key))
+            negatives.push_back(key);
+    }
+
+    vector<PolicyConfig> configs = {
+        {"failure 500", EXPAND_ON_FAILURE, 500, 0},
+        {"failure 64", EXPAND_ON_FAILURE, 64, 0},
+        {"failure 16", EXPAND_ON_FAILURE, 16, 0},
+        {"load 0.95", EXPAND_ON_LOAD, 500, 0.95},
+        {"load 0.9", EXPAND_ON_LOAD, 500, 0.9},
+        {"load 0.8", EXPAND_ON_LOAD, 500, 0.8},
+        {"adaptive", EXPAND_ADAPTIVE, 500, 0},
+    };
+    cout << std::setprecision(3) << std::fixed;
+    for (int fgpt_per_bucket : {4, 8}) {
+        for (PolicyConfig &config : configs)
+            bench_policy(fgpt_per_bucket, config, keys, negatives);
+    }
+}
@@ -0,0 +1,113 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+using std::cout, std::endl;
+
+/* Per-operation latency of the default hashing (32-bit hash of the key,
+ * second hash for the alt bucket) against hash-once mode, see
+ * BambooBase::_hash_once. */
+
+volatile u64 sink;
+
+struct OpTimes {
+    double insert;
+    double count;
+    double remove;
+};
+
+
+double ns_since(std::chrono::_V2::high_resolution_clock::time_point t1,
+        int ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / ops;
+}
+
+
+OpTimes bench_hashing(int fgpt_size, int fgpt_per_bucket, int num_elements,
+        bool hash_once)
+{
+    int bucket_idx_len = 8;
+    int seg_idx_base = 4;
+    int lookups = 2 * num_elements;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    bbf->_hash_once = hash_once;
+
+    OpTimes t;
+    u64 sum = 0;
+    int removed = 0;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_elements; ++i)
+        bbf->insert(2*i);
+    t.insert = ns_since(t1, num_elements);
+
+    /* Half of the lookups hit */
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        sum += bbf->count(i);
+    t.count = ns_since(t1, lookups);
+
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_elements; ++i)
+        removed += bbf->remove(2*i);
+    t.remove = ns_since(t1, num_elements);
+
+    if (removed != num_elements)
+        cout << "** " << num_elements - removed << " removes failed **" << endl;
+    if (bbf->occupancy())
+        cout << "** " << bbf->occupancy() << " fgpts left **" << endl;
+    sink += sum;
+    delete bbf;
+    return t;
+}
+
+
+void bench_config(int fgpt_size, int fgpt_per_bucket, int num_elements)
+{
+    /* Best of a few alternating runs, the differences are tens of ns */
+    int runs = 3;
+    OpTimes base, once, t;
+    for (int r = 0; r < runs; ++r) {
+        for (bool hash_once : {false, true}) {
+            t = bench_hashing(fgpt_size, fgpt_per_bucket, num_elements,
+                hash_once);
+            OpTimes &best = hash_once ? once : base;
+            if (!r) {
+                best = t;
+                continue;
+            }
+            best.insert = std::min(best.insert, t.insert);
+            best.count = std::min(best.count, t.count);
+            best.remove = std::min(best.remove, t.remove);
+        }
+    }
+
+    cout << "fgpt_size " << std::setw(2) << fgpt_size
+        << " slots " << std::setw(2) << fgpt_per_bucket
+        << " items " << num_elements << endl;
+    cout << "   insert :: " << std::setw(7) << base.insert << " -> "
+        << std::setw(7) << once.insert << " ns/op :: saved "
+        << base.insert - once.insert << endl;
+    cout << "   count  :: " << std::setw(7) << base.count << " -> "
+        << std::setw(7) << once.count << " ns/op :: saved "
+        << base.count - once.count << endl;
+    cout << "   remove :: " << std::setw(7) << base.remove << " -> "
+        << std::setw(7) << once.remove << " ns/op :: saved "
+        << base.remove - once.remove << endl;
+}
+
+
+int main()
+{
+    srand(0);
+    cout << std::setprecision(2) << std::fixed;
+    bench_config(7, 4, 200000);
+    bench_config(15, 4, 2000000);
+    bench_config(15, 8, 2000000);
+    bench_config(23, 8, 2000000);
+}
@@ -0,0 +1,108 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <unordered_set>
+
+using std::cout, std::endl;
+
+/* Compares the hash policies of BambooBase (see HashPolicy): insert and
+ * lookup throughput, and the measured false positive rate. Keys are
+ * uniformly random 32-bit integers so that HASH_IDENTITY applies. */
+
+volatile u64 sink;
+
+const char *policy_name(HashPolicy policy)
+{
+    switch (policy) {
+    case HASH_MIX:
+        return "mix     ";
+    case HASH_IDENTITY:
+        return "identity";
+    default:
+        return "spooky  ";
+    }
+}
+
+
+double ops_per_us(std::chrono::_V2::high_resolution_clock::time_point t1,
+        int ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+void bench_policy(int fgpt_size, int fgpt_per_bucket, HashPolicy policy,
+        vector<int> &keys, vector<int> &negatives)
+{
+    int bucket_idx_len = 8;
+    int seg_idx_base = 4;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    bbf->_hash_policy = policy;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int key : keys)
+        bbf->insert(key);
+    double inserts = ops_per_us(t1, keys.size());
+
+    u64 hits = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int key : keys)
+        hits += bbf->count(key) > 0;
+    double positives = ops_per_us(t1, keys.size());
+
+    u64 fp = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int key : negatives)
+        fp += bbf->count(key) > 0;
+    double lookups = ops_per_us(t1, negatives.size());
+
+    cout << "fgpt_size " << std::setw(2) << fgpt_size
+        << " slots " << std::setw(2) << fgpt_per_bucket
+        << " " << policy_name(policy)
+        << " :: insert " << std::setw(7) << inserts << " M/s"
+        << " :: count+ " << std::setw(7) << positives << " M/s"
+        << " :: count- " << std::setw(7) << lookups << " M/s"
+        << " :: FPR " << std::setprecision(6) << (double) fp / negatives.size()
+        << std::setprecision(3)
+        << " :: load " << (double) bbf->occupancy() / bbf->capacity();
+    if (hits != keys.size())
+        cout << " ** " << keys.size() - hits << " false negatives **";
+    cout << endl;
+    sink += hits + fp;
+    delete bbf;
+}
+
+
+int main()
+{
+    int num_elements = 2000000;
+    int num_negatives = 4000000;
+    std::mt19937 gen(0);
+    std::unordered_set<int> seen;
+    vector<int> keys, negatives;
+    while ((int) keys.size() < num_elements) {
+        int key = gen();
+        if (seen.insert(key).second)
+            keys.push_back(key);
+    }
+    while ((int) negatives.size() < num_negatives) {
+        int key = gen();
+        if (!seen.count(key))
+            negatives.push_back(key);
+    }
+
+    cout << std::setprecision(3) << std::fixed;
+    for (int fgpt_size : {7, 15}) {
+        for (HashPolicy policy : {HASH_SPOOKY, HASH_MIX, HASH_IDENTITY}) {
+            /* 7-bit fgpts allow few expansions */
+            vector<int> sub(keys.begin(),
+                keys.begin() + (fgpt_size == 7 ? num_elements / 10 : num_elements));
+            bench_policy(fgpt_size, 8, policy, sub, negatives);
+        }
+    }
+}
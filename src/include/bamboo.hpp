@@ -8,8 +8,13 @@
 #include <iostream>
 #include <exception>
 #include <string>
+#include <string_view>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
 
 #include "SpookyV2.h"
+#include "fastrand.hpp"
 
 using std::vector, std::unordered_map, std::bitset;
 using std::cout, std::endl, std::cerr, std::flush;
@@ -22,27 +27,34 @@ typedef uint8_t u8;
 
 struct Bucket {
     u8 *_bits;    /* Each fgpt is stored in a contiguous subarray along with
-                   * a flag bit. See implementation for details */
-    u16 _len;     /* Length of array allocated to *_bits* */
+                   * a flag bit. See implementation for details. The array
+                   * lives in the slab of the owning Segment. */
+    u16 _len;     /* Length of the array at *_bits* */
     u8 _fgpt_size;
     u8 _step;
 
-    Bucket(u8 fgpt_size) {_fgpt_size = fgpt_size; 
-                          _step = (_fgpt_size + 7) / 8;}
-    ~Bucket() { delete[] _bits; }
+    /* Buckets are lightweight views handed out by Segment::bucket() */
+    Bucket(u8 *bits, u16 len, u8 fgpt_size, u8 step) :
+            _bits(bits), _len(len), _fgpt_size(fgpt_size), _step(step) {}
 
-    /* Must be called after initialization to allocate the array.
-     * This is here because I have yet to study copy-semantics, and
-     * including this directly in the constructor gives issues. */
-    void initialize(int capacity, int fgpt_size);
+    inline u64 _slot_mask()
+    {
+        int n = _len/_step;
+        return n == 64 ? ~(u64) 0 : ((u64) 1 << n) - 1;
+    }
+    inline u32 _entry_mask() { return (1u << (8*_step)) - 1; }
 
+    u64 _probe(u32 key, u32 mask);
     bool _occupied_idx (int idx);
     int _vacant_idx();
+    u64 occupied_mask();
     u32 count_at(int idx);
     u32 count_fgpt_at(u32 fgpt, int idx);
     /* Returns the index where the first fingerprint is found */
     int find_fgpt(u32 fgpt); 
     int count_fgpt(u32 fpgt);
+    u64 match_fgpt(u32 fgpt);
+    u64 flag_mask();
     u32 insert_fgpt(u32 fgpt);
     u32 insert_fgpt_count(u32 fgpt, u32 &count);
     void insert_fgpt_at(int idx, u32 fgpt);
@@ -60,8 +72,19 @@ struct Bucket {
     void increment_at(int idx);
     void decrement_at(int idx);
 
+    /* Calls visit(fgpt, count) on every occupied slot. Prefer this to
+     * retrieve_all(), which allocates per slot */
+    template <typename F>
+    inline void for_each(F &&visit)
+    {
+        for (u64 occ = occupied_mask(); occ; occ &= occ - 1) {
+            int idx = __builtin_ctzll(occ);
+            visit(get_fgpt_at(idx), (u32) (_bits[idx*_step] & 1) + 1);
+        }
+    }
+
     vector<vector<u32>> retrieve_all();
-    void split_bucket(Bucket &dst, int sep_lvl);
+    void split_bucket(Bucket dst, int sep_lvl);
     u32 occupancy();
 
     void dump_bucket();
@@ -70,24 +93,121 @@ struct Bucket {
 
 
 
+struct Segment;
+
+/* A segment split in progress, see Bamboo::_lazy_split. Bucket *i* of *src*
+ * still holds the fgpts of both halves until bit *i* of *migrated* is set */
+struct SplitState {
+    Segment *src;
+    Segment *dst;
+    int sep_lvl;
+    u32 num_migrated;
+    u32 next;           /* Where the next step of Bamboo::_advance_splits 
+                         * resumes */
+    vector<u64> migrated;
+
+    inline bool is_migrated(u32 bidx)
+    {
+        return migrated[bidx >> 6] >> (bidx & 63) & 1;
+    }
+    inline bool done() { return !src; }
+};
+
+
+/* A bucket reached by the breadth-first cuckoo search, see
+ * BambooBase::_cuckoo_bfs. The entry at *slot* of the *parent* node's 
+ * bucket moves to *bidx* */
+struct CuckooNode {
+    u32 bidx;
+    int parent;
+    int slot;
+};
+
+
+/* An entry parked in the stash of a segment: the raw bucket entry, see
+ * Bucket, and one of the two buckets of its fgpt */
+struct StashEntry {
+    u32 entry;
+    u32 bidx;
+};
+
+
 struct Segment {
-    vector<Bucket> buckets;
+    u8 *_slab;          /* Storage of all buckets, back to back. Starts on
+                         * a cache line; buckets of a power of two bytes
+                         * then never straddle two, others (6 or 12 bytes)
+                         * may */
+    u8 *_packed;        /* Semi-sorted encoding of the buckets while the
+                         * segment is packed, in which case *_slab* is null.
+                         * See semisort.hpp */
+    u16 _bucket_len;    /* Bytes per bucket */
+    u8 _step;
+    u8 fgpt_size;
+    int num_buckets;
     Segment *overflow;
     int expansion_count;
-    u8 fgpt_size;
+    SplitState *_split;     /* Set on both halves while a lazy split of 
+                             * them is in progress */
+    u32 _load;              /* Approximate number of fgpt copies, only kept
+                             * while a BackgroundExpander is attached */
+    static const int STASH_MAX = 8;
+    u8 _stash_len;          /* Entries whose cuckoo chain failed, see
+                             * BambooBase::_stash_size */
+    StashEntry _stash[STASH_MAX];
     
-    Segment(int num_buckets, int fgpt_size, int fgpt_per_bucket, int expansion__count) :
-            expansion_count(expansion__count),
-            fgpt_size(fgpt_size)
-    {
-        if (fgpt_size != 7 && fgpt_size != 15 && fgpt_size != 23)
-            throw std::runtime_error("Fgpt size not supported");
-        buckets = vector<Bucket>(num_buckets, fgpt_size);
-        overflow = nullptr;
-        for (int i=0; i<num_buckets; ++i) {
-            buckets[i].initialize(fgpt_per_bucket, fgpt_size);
+    Segment(int num_buckets, int fgpt_size, int fgpt_per_bucket, int expansion__count);
+    ~Segment();
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+
+    /* Only valid while the segment is not packed */
+    inline Bucket bucket(u32 idx)
+    {
+        return Bucket(_slab + idx * _bucket_len, _bucket_len, fgpt_size, _step);
+    }
+
+    /* Migrates bucket *bidx* of a lazy split before it is written to */
+    inline void settle(u32 bidx)
+    {
+        if (_split && !_split->is_migrated(bidx))
+            _migrate(bidx);
+    }
+    void _migrate(u32 bidx);
+    void finish_split();
+    /* Copies of *fgpt* for this segment still waiting in the unmigrated
+     * buckets of the split source */
+    int count_unmigrated(u32 bidx, u32 fgpt);
+
+    /* Copies of *fgpt* in the stash under the bucket pair *bidx1*, 
+     * *bidx2* */
+    inline int count_stash(u32 bidx1, u32 bidx2, u32 fgpt)
+    {
+        int count = 0;
+        for (int i = 0; i < _stash_len; ++i) {
+            if (_stash[i].entry >> 1 == fgpt 
+                    && (_stash[i].bidx == bidx1 || _stash[i].bidx == bidx2))
+                count += (_stash[i].entry & 1) + 1;
         }
+        return count;
     }
+    bool remove_stash(u32 bidx1, u32 bidx2, u32 fgpt);
+    /* Empties the stash, then calls visit(bidx, entry) per entry. *visit*
+     * may stash again */
+    template <typename F>
+    inline void drain_stash(F &&visit)
+    {
+        StashEntry stash[STASH_MAX];
+        int n = _stash_len;
+        std::copy(_stash, _stash + n, stash);
+        _stash_len = 0;
+        for (int i = 0; i < n; ++i)
+            visit(stash[i].bidx, stash[i].entry);
+    }
+
+    void _allocate_slab();
+    bool pack();
+    void unpack();
+    int count_packed(u32 bidx, u32 fgpt);
 
     u32 occupancy();
 };
@@ -111,6 +231,69 @@ struct BitTrie {
 };
 
 
+/* How keys are hashed. HASH_SPOOKY is the original SpookyHash. HASH_MIX is
+ * a multiply-xorshift mixer (the murmur3 finalizer) that is much cheaper
+ * for integer keys. HASH_IDENTITY uses the key bits as they are, for keys
+ * that are already uniformly random; int keys only have 32 bits, so keep
+ * *bucket_idx_len + seg_idx_base + fgpt_size* within that for them. */
+enum HashPolicy {
+    HASH_SPOOKY,
+    HASH_MIX,
+    HASH_IDENTITY
+};
+
+
+/* When a segment splits. EXPAND_ON_FAILURE splits once a cuckoo chain 
+ * reaches *_chain_max* evictions; a small *_chain_max* gives up early.
+ * EXPAND_ON_LOAD (Bamboo only) splits a segment after the insert that 
+ * fills *_expand_load* of its slots, with *_chain_max* as the fallback.
+ * EXPAND_ADAPTIVE bounds chains by a multiple of the running average 
+ * length of the chains that succeeded, see _chain_bound(). */
+enum ExpandPolicy {
+    EXPAND_ON_FAILURE,
+    EXPAND_ON_LOAD,
+    EXPAND_ADAPTIVE
+};
+
+
+/* Locks *m* for the scope of a filter operation, if there is one to lock.
+ * See BackgroundExpander */
+struct OpGuard {
+    std::mutex *m;
+    OpGuard(std::mutex *m) : m(m) { if (m) m->lock(); }
+    ~OpGuard() { if (m) m->unlock(); }
+};
+
+
+struct BackgroundExpander;
+struct BuildState;
+
+
+/* Integer key types other than int and u64. The key API sends those of
+ * up to 32 bits to the int overloads, as they converted before the u64 
+ * ones existed, and wider ones to the u64 overloads */
+template <typename T>
+using OtherIntKey = std::enable_if_t<std::is_integral_v<T> 
+    && !std::is_same_v<T, int> && !std::is_same_v<T, u64>, int>;
+
+
+/* A key the caller already hashed to 64 bits, see BambooBase::insert_hash.
+ * Lets templated callers such as Abacus pass hashes through the key
+ * overloads. */
+struct HashedKey {
+    u64 hash;
+};
+
+
+/* A key of Bamboo::insert_batch, hashed but not placed yet. See
+ * BambooBase::_route */
+struct RoutedKey {
+    u32 fgpt;
+    u32 hashfrag;
+    u32 bidx1;
+};
+
+
 struct BambooBase {
     int _num_segments;
     int _bucket_idx_len;
@@ -122,8 +305,40 @@ struct BambooBase {
     u32 _seed;
     u32 _alt_seed;
     u32 _bucket_mask;
+    /* Picks eviction victims. Seeded from *_seed* and *_alt_seed*; reseed
+     * it for a different eviction order under the same hashes */
+    FastRand _rng;
 
     u32 _chain_max = 500;
+    /* Set while a BackgroundExpander is attached: the key API then runs
+     * under *_op_mutex*, shared with the worker */
+    BackgroundExpander *_expander = nullptr;
+    std::mutex *_op_mutex = nullptr;
+    /* Derive fgpt, bucket and segment from a single 64-bit hash of the key,
+     * and the alt bucket from a multiplication of the fgpt instead of a 
+     * second hash. Changes where items go, so set it before inserting */
+    bool _hash_once = false;
+    /* Other policies than HASH_SPOOKY always use the hash-once layout. Set
+     * it before inserting, too */
+    HashPolicy _hash_policy = HASH_SPOOKY;
+    /* Set it before inserting, EXPAND_ON_LOAD counts the load from there */
+    ExpandPolicy _expand_policy = EXPAND_ON_FAILURE;
+    /* EXPAND_ADAPTIVE: moving average of successful chain lengths, times
+     * 16 */
+    int _chain_avg = 0;
+    /* Insert with a breadth-first search for the shortest eviction path
+     * instead of a random walk, see _cuckoo_bfs() */
+    bool _bfs_cuckoo = false;
+    /* Set while build() fills segments from several threads; _cuckoo()
+     * then leaves *stats* alone */
+    bool _shared_fill = false;
+    vector<CuckooNode> _bfs_nodes;
+    vector<u64> _bfs_seen;
+    /* Up to this many entries per segment (at most Segment::STASH_MAX)
+     * whose cuckoo chain failed wait in a stash instead of triggering an
+     * overflow. Lookups check it when it is not empty; it drains into the
+     * halves when the segment splits */
+    u32 _stash_size = 0;
 
     /* statistics */
     struct {
@@ -147,33 +362,285 @@ struct BambooBase {
             u32 seed, u32 alt_seed);
     virtual ~BambooBase();
 
-    int count(int elt);
+    virtual int count(int elt);
     virtual bool insert(int elt);
     virtual bool insert(int elt, u32 fgpt, u32 seg_idx, Segment *segment,
             u32 bidx1, u32 bidx2);
-    bool remove(int elt);
+    virtual bool remove(int elt);
+
+    /* 64-bit and byte-string keys. They are hashed once to 64 bits (see
+     * _compute_hash64) and placed like hash-once keys, so they can share 
+     * a filter with int keys. The key type selects the hash: outside
+     * hash-once mode, insert(5) and insert((u64) 5) are different keys */
+    inline int count(u64 key) { return count_hash(_compute_hash64(key)); }
+    inline bool insert(u64 key) { return insert_hash(_compute_hash64(key)); }
+    inline bool remove(u64 key) { return remove_hash(_compute_hash64(key)); }
+    inline int count(std::string_view key) 
+    { 
+        return count_hash(_compute_hash64(key)); 
+    }
+    inline bool insert(std::string_view key) 
+    { 
+        return insert_hash(_compute_hash64(key)); 
+    }
+    inline bool remove(std::string_view key) 
+    { 
+        return remove_hash(_compute_hash64(key)); 
+    }
+    inline int count(HashedKey key) { return count_hash(key.hash); }
+    inline bool insert(HashedKey key) { return insert_hash(key.hash); }
+    inline bool remove(HashedKey key) { return remove_hash(key.hash); }
+    /* Other integer types, see OtherIntKey */
+    template <typename T, OtherIntKey<T> = 0>
+    inline int count(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return count((int) key);
+        else
+            return count((u64) key);
+    }
+    template <typename T, OtherIntKey<T> = 0>
+    inline bool insert(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return insert((int) key);
+        else
+            return insert((u64) key);
+    }
+    template <typename T, OtherIntKey<T> = 0>
+    inline bool remove(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return remove((int) key);
+        else
+            return remove((u64) key);
+    }
+
+    /* Entry points for callers that already hold a good 64-bit hash of 
+     * the key. The filter does not hash it again */
+    virtual int count_hash(u64 hash);
+    virtual bool insert_hash(u64 hash);
+    virtual bool remove_hash(u64 hash);
+
+    /* Whether the filter holds at least one copy of the key. Unlike 
+     * count() > 0, it stops at the first bucket, stash or segment of an
+     * overflow chain that holds the fgpt */
+    virtual bool contains(int elt);
+    inline bool contains(u64 key) 
+    { 
+        return contains_hash(_compute_hash64(key)); 
+    }
+    inline bool contains(std::string_view key) 
+    { 
+        return contains_hash(_compute_hash64(key)); 
+    }
+    inline bool contains(HashedKey key) { return contains_hash(key.hash); }
+    template <typename T, OtherIntKey<T> = 0>
+    inline bool contains(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return contains((int) key);
+        else
+            return contains((u64) key);
+    }
+    virtual bool contains_hash(u64 hash);
+
+    /* Counts of *keys[0..n)* into *counts*, as count() on each would give.
+     * The keys go through in windows of BATCH_WINDOW: the whole window is
+     * hashed and its segments prefetched, then its buckets, then it is
+     * probed, so that the cache misses of a window overlap instead of
+     * following one another */
+    static const int BATCH_WINDOW = 16;
+    virtual void count_batch(const int *keys, size_t n, u32 *counts);
+    virtual void count_batch(const u64 *keys, size_t n, u32 *counts);
+    virtual void contains_batch(const int *keys, size_t n, bool *found);
+    virtual void contains_batch(const u64 *keys, size_t n, bool *found);
+    template <typename Key, typename Out>
+    void _count_batch(const Key *keys, size_t n, Out *out);
+    /* Prefetches what _get_segment() will read for *hashfrag* */
+    virtual void _prefetch_route(u32 hashfrag) {}
+
+    /* Called by every insert and remove before the key is extracted */
+    virtual void _advance_splits() {}
+    /* Background expansion hooks, see BackgroundExpander. _note_load() is
+     * called after each successful insert (+1) and remove (-1) while the
+     * expander is attached or under EXPAND_ON_LOAD. _background_step() 
+     * does one unit of expansion work and returns false once there is 
+     * none left */
+    virtual void _note_load(Segment *segment, u32 seg_idx, int delta) {}
+    virtual bool _background_step() { return false; }
+    virtual void _init_load() {}
+    inline bool _tracks_load()
+    {
+        return _expander || _expand_policy == EXPAND_ON_LOAD;
+    }
+    /* Called after each successful remove of the key API */
+    virtual void _note_remove() {}
+    /* The slot a cuckoo step evicts from */
+    virtual u32 _victim_slot() { return _rng.below(_fgpt_per_bucket); }
+
+    /* Number of segment index bits that hold *expected_items* at no more
+     * than *target_load* of the slots, at least *_seg_idx_base* */
+    u32 _reserve_depth(u64 expected_items, double target_load);
+
+    /* What count and remove do once the key is extracted. Overridden by
+     * the specialized engines */
+    virtual int _count_extracted(u32 fgpt, Segment *segment, u32 bidx1,
+            u32 bidx2);
+    virtual bool _remove_extracted(u32 fgpt, Segment *segment, u32 bidx1,
+            u32 bidx2);
+    virtual bool _contains_extracted(u32 fgpt, Segment *segment, u32 bidx1,
+            u32 bidx2);
 
     void adjust_to(int elt, int cnt);
+    /* Evictions after which _cuckoo() gives up and calls overflow(). The
+     * adaptive bound is eight times the average successful chain, which
+     * grows as segments fill up */
+    inline u32 _chain_bound()
+    {
+        if (_expand_policy != EXPAND_ADAPTIVE)
+            return _chain_max;
+        /* Never past _chain_max, even if it is below 16 */
+        return std::min(std::max<u32>(_chain_avg / 2, 16), _chain_max);
+    }
     bool _cuckoo(Segment *segment, u32 seg_idx, u32 bi_main, u32 bi_alt, 
             u32 fgpt, u32 fgpt_cnt, u32 chain_len);
+    bool _cuckoo_bfs(Segment *segment, u32 seg_idx, u32 bi_main, u32 bi_alt, 
+            u32 fgpt, u32 fgpt_cnt);
+    /* Parks *fgpt* in the stash of *segment* if it has room */
+    inline bool _stash_put(Segment *segment, u32 bidx, u32 fgpt, 
+            u32 fgpt_cnt)
+    {
+        if (segment->_stash_len >= std::min<u32>(_stash_size, 
+                Segment::STASH_MAX))
+            return false;
+        segment->_stash[segment->_stash_len++] = 
+            {fgpt << 1 | (fgpt_cnt - 1), bidx};
+        return true;
+    }
     // u32 _find_segment_idx(u32 hash);
+    /* The part of _extract() that only needs the hash: the fgpt, the
+     * hash fragment _get_segment() takes and the main bucket */
+    inline void _route(int elt, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        if (_hash_once || _hash_policy != HASH_SPOOKY)
+            return _route_hash(_compute_hash64(elt), fgpt, hashfrag, bidx1);
+        u32 hash = _compute_hash(elt);
+        fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+            & ((1<<_fgpt_size) - 1);
+        /* Rehash while the fingerprint is all zeros */
+        while (!fgpt) {
+            hash = _compute_hash(hash);
+            fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+                & ((1<<_fgpt_size) - 1);
+        }
+        hashfrag = hash >> _bucket_idx_len;
+        bidx1 = hash & _bucket_mask;
+    }
+    inline void _route(u64 key, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        _route_hash(_compute_hash64(key), fgpt, hashfrag, bidx1);
+    }
+    inline void _route_hash(u64 hash, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        hash >>= _offset;
+        fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+            & ((1<<_fgpt_size) - 1);
+        if (!fgpt)
+            fgpt = 1 << (_fgpt_size - 1);
+        hashfrag = (fgpt << _seg_idx_base)
+            | ((hash >> _bucket_idx_len) & ((1<<_seg_idx_base) - 1));
+        bidx1 = hash & _bucket_mask;
+    }
     bool _extract(int elt, u32 &fgpt, u32 &seg_idx, Segment *&segment,
             u32 &bidx1, u32 &bidx2); 
+    bool _extract_hash(u64 hash, u32 &fgpt, u32 &seg_idx, Segment *&segment,
+            u32 &bidx1, u32 &bidx2); 
 
     inline u32 _alt_bucket(u32 fgpt, u32 bidx)
     {
-        u32 alt = fgpt;
-        while (true) {
-            alt = (_h.Hash32(&alt, 4, _alt_seed) >> _offset) & _bucket_mask;
-            if (alt)
-                break;
+        if (_hash_once || _hash_policy != HASH_SPOOKY) {
+            u32 off = (u32) (((u64) fgpt * 0x9E3779B97F4A7C15ull) >> 40) 
+                & _bucket_mask;
+            return (bidx ^ (off ? off : 1)) & _bucket_mask;
         }
-        return (bidx ^ alt) & _bucket_mask;
+        u32 alt = (_h.Hash32(&fgpt, 4, _alt_seed) >> _offset) & _bucket_mask;
+        /* Rehashing a zero offset can cycle on 0 for some seeds */
+        return (bidx ^ (alt ? alt : 1)) & _bucket_mask;
     }
     inline u32 _compute_hash(int elt)
     {
         return _h.Hash32(&elt, 4, _seed) >> _offset;
     }
+    static inline u64 _mix64(u64 x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+    inline u64 _compute_hash64(int elt)
+    {
+        switch (_hash_policy) {
+        case HASH_MIX:
+            return _mix64((u32) elt | ((u64) _seed << 32));
+        case HASH_IDENTITY:
+            return (u32) elt;
+        default:
+            return _h.Hash64(&elt, 4, _seed);
+        }
+    }
+    inline u64 _compute_hash64(u64 key)
+    {
+        switch (_hash_policy) {
+        case HASH_MIX:
+            return _mix64(key ^ ((u64) _seed * 0x9E3779B97F4A7C15ull));
+        case HASH_IDENTITY:
+            return key;
+        default:
+            return _h.Hash64(&key, 8, _seed);
+        }
+    }
+    /* Strings always go through SpookyHash */
+    inline u64 _compute_hash64(std::string_view key)
+    {
+        return _h.Hash64(key.data(), key.size(), _seed);
+    }
+
+    inline int _count_segment(Segment *segment, u32 fgpt, u32 bidx1, 
+            u32 bidx2)
+    {
+        int count = segment->_stash_len ? 
+            segment->count_stash(bidx1, bidx2, fgpt) : 0;
+        if (segment->_packed)
+            return count + segment->count_packed(bidx1, fgpt) 
+                + segment->count_packed(bidx2, fgpt);
+        count += segment->bucket(bidx1).count_fgpt(fgpt) 
+            + segment->bucket(bidx2).count_fgpt(fgpt);
+        if (segment->_split)
+            count += segment->count_unmigrated(bidx1, fgpt)
+                + segment->count_unmigrated(bidx2, fgpt);
+        return count;
+    }
+
+    /* _count_segment() > 0, without counting past the first match */
+    inline bool _contains_segment(Segment *segment, u32 fgpt, u32 bidx1, 
+            u32 bidx2)
+    {
+        if (segment->_stash_len 
+                && segment->count_stash(bidx1, bidx2, fgpt))
+            return true;
+        if (segment->_packed)
+            return segment->count_packed(bidx1, fgpt) 
+                || segment->count_packed(bidx2, fgpt);
+        if (segment->bucket(bidx1).match_fgpt(fgpt)
+                || segment->bucket(bidx2).match_fgpt(fgpt))
+            return true;
+        return segment->_split && (segment->count_unmigrated(bidx1, fgpt)
+            || segment->count_unmigrated(bidx2, fgpt));
+    }
 
     virtual Segment *_get_segment(u32 hash, u32 &seg_idx) = 0;
     virtual bool overflow(Segment *segment, u32 seg_idx, u32 bi_main, 
@@ -188,7 +655,40 @@ struct BambooBase {
 
 
 struct Bamboo : BambooBase {
-    BitTrie *_trie_head;
+    /* Extendible hashing directory. Entry *i* holds the segment of the hash
+     * fragments whose low *_global_depth* bits are *i*. A segment of local
+     * depth *d* (see _local_depth) fills the 2^(_global_depth - d) entries
+     * that agree with its index on the low *d* bits. The directory doubles
+     * when a segment splits past the global depth. */
+    vector<Segment*> _directory;
+    u32 _global_depth;
+    u32 _dir_mask;
+
+    /* Lazy splitting: overflow() registers the new segment at once but
+     * leaves the fgpts in place. A bucket migrates when an insert, remove
+     * or cuckoo chain first writes to it, and every insert and remove
+     * migrates *_split_step* more buckets of the oldest pending split.
+     * Lookups of the new half also look in the unmigrated buckets of the
+     * old one. Bounds the work of the insert that triggers a split */
+    bool _lazy_split = false;
+    u32 _split_step = 8;
+    vector<SplitState*> _pending_splits;
+
+    /* With a BackgroundExpander, segments whose load reaches this share of
+     * their slots are queued to be split ahead of the cuckoo failure */
+    double _presplit_load = 0.9;
+    /* Under EXPAND_ON_LOAD, segments split once their load reaches this
+     * share of their slots */
+    double _expand_load = 0.9;
+    vector<std::pair<Segment*, u32>> _presplit_queue;
+
+    /* shrink() merges two sibling segments when together they fill at
+     * most *_merge_load* of one. With *_shrink_load* set, removes call
+     * shrink() once the occupancy drops below that share of the capacity;
+     * it is checked every 1/16 of the capacity in removes */
+    double _merge_load = 0.5;
+    double _shrink_load = 0;
+    u32 _removes = 0;
 
     Bamboo(int bucket_idx_len, int fgpt_size, 
             int fgpt_per_bucket, int seg_idx_base);
@@ -204,31 +704,125 @@ struct Bamboo : BambooBase {
 
     void _initialize_segments();
 
+    inline u32 _local_depth(Segment *segment)
+    {
+        return _seg_idx_base + segment->expansion_count;
+    }
+
     /* Returns the segment, and computes its index and stores it
      * in *seg_idx* */
-    inline Segment *_get_segment(u32 hashfrag, u32 &seg_idx)
+    inline Segment *_get_segment(u32 hashfrag, u32 &seg_idx) override
     {
-        seg_idx = hashfrag;
-        u32 depth = 0;
-        Segment *s = _trie_head->retrieve(hashfrag, depth);
-        seg_idx &= (1 << depth) - 1;
+        Segment *s = _directory[hashfrag & _dir_mask];
+        seg_idx = hashfrag & ((1u << _local_depth(s)) - 1);
         return s;
     }
+    /* The directory is small enough to stay cached, the segment header
+     * is not; its fields may straddle two lines */
+    inline void _prefetch_route(u32 hashfrag) override
+    {
+        Segment *s = _directory[hashfrag & _dir_mask];
+        __builtin_prefetch(s);
+        __builtin_prefetch((u8 *) s + sizeof(Segment) - 1);
+    }
+
+    /* Points the directory entries of index *seg_idx* at local depth 
+     * *depth* to *segment*, doubling the directory first if needed */
+    virtual void _set_segment(u32 seg_idx, u32 depth, Segment *segment);
+
+    void _advance_splits() override;
+    void _finish_splits();
+    Segment *split(Segment *segment, u32 seg_idx);
+
+    /* Splits segments up front until *expected_items* fit at 
+     * *target_load*, so that a bulk load does not discover the size one
+     * failed cuckoo chain at a time. Every segment ends up with the same 
+     * local depth, as hashes spread evenly over them. Best called before 
+     * inserting; throws if the size is out of reach of the fgpt size */
+    void reserve(u64 expected_items, double target_load = 0.85);
+    void _reserve(u64 expected_items, double target_load);
+
+    /* Inserts *n* u64 keys, like insert(u64) on each, using *threads*
+     * threads: the filter is reserve()d for them at *target_load*, the 
+     * keys are hashed in parallel and partitioned by segment, and the 
+     * segments fill independently. A cuckoo chain that fails meanwhile
+     * leaves its fgpt for a sequential pass at the end, which may split.
+     * The fill bounds chains by *_chain_max* under any _expand_policy and
+     * leaves *stats* out. Filters with the same seeds come out the same 
+     * for any number of threads */
+    void build(const u64 *keys, size_t n, int threads, 
+            double target_load = 0.85);
+    /* Set during the parallel part of build() */
+    BuildState *_build = nullptr;
+    bool _defer(u32 seg_idx, u32 bi_main, u32 bi_alt, u32 fgpt, 
+            u32 fgpt_cnt);
+    u32 _victim_slot() override;
+
+    /* Inserts *keys[0..n)* like insert() on each, and returns how many 
+     * went in. The keys are hashed first and radix sorted by directory
+     * index, so each segment takes its keys in one run while its buckets
+     * are cached. Each key is routed again when it is placed, so a split
+     * in the middle of a run sends the rest of it to the right half */
+    virtual size_t insert_batch(const int *keys, size_t n);
+    virtual size_t insert_batch(const u64 *keys, size_t n);
+    template <typename Key> size_t _insert_batch(const Key *keys, size_t n);
+
+    void _note_load(Segment *segment, u32 seg_idx, int delta) override;
+    bool _background_step() override;
+    void _init_load() override;
+
+    /* Merges sibling segments back while they fit in one, the reverse of
+     * split(), and halves the directory while no segment needs its full
+     * depth. For delete-heavy workloads; returns the number of merges */
+    int shrink();
+    int _shrink();
+    Segment *_merge(Segment *low, Segment *high);
+    bool _place_entry(Segment *segment, u32 bidx, u32 entry);
+    void _note_remove() override;
+
+    /* Calls visit(segment, seg_idx) once per segment */
+    template <typename F>
+    inline void for_each_segment(F &&visit)
+    {
+        for (u32 i = 0; i < _directory.size(); ++i) {
+            if (!(i >> _local_depth(_directory[i])))
+                visit(_directory[i], i);
+        }
+    }
 
     bool overflow(Segment *segment, u32 seg_idx, u32 bi_main, 
             u32 bi_alt, u32 fgpt, u32 fgpt_cnt) override;
 
+    /* Switches all segments to the semi-sorted encoding, which needs 4 
+     * fgpts per bucket of 7 or 15 bits. Lookups decode the packed buckets,
+     * a segment is unpacked again by the first insert or remove on it.
+     * Returns false if the layout cannot be packed. */
+    bool pack();
+
     u32 occupancy() override;
     u32 capacity() override;
     void dump_succinct() override;
 };
 
 
+/* Runtime-dispatch factory: returns a BambooFixed (see fixedbamboo.hpp)
+ * when one is instantiated for *fgpt_size* and *fgpt_per_bucket*, and a
+ * runtime Bamboo otherwise. Arguments are those of the Bamboo constructors */
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base);
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base, int offset);
+Bamboo *make_bamboo(int bucket_idx_len, int fgpt_size, 
+        int fgpt_per_bucket, int seg_idx_base, int offset,
+        u32 seed, u32 alt_seed);
+
+
 struct BambooOverflow : BambooBase {
     int _expand_prompt;
     int _insert_count;
     int _next_seg_idx;
     int _expand_base;
+    int _pending_expands = 0;   /* Left to the BackgroundExpander */
 
     vector<Segment*> _segments;
 
@@ -236,8 +830,17 @@ struct BambooOverflow : BambooBase {
             int fgpt_per_bucket, int seg_idx_base);
     ~BambooOverflow();
 
-    bool insert(int elt) override;
+    using BambooBase::insert;
+    bool insert(int elt, u32 fgpt, u32 seg_idx, Segment *segment,
+            u32 bidx1, u32 bidx2) override;
     void expand(int seg_idx);
+    void _expand_next();
+    bool _background_step() override;
+
+    /* Expands up front to enough segments for *expected_items* at 
+     * *target_load*, and holds back the paced expansions of as many
+     * inserts. See Bamboo::reserve */
+    void reserve(u64 expected_items, double target_load = 0.85);
 
     inline Segment *_get_segment(u32 hash, u32 &seg_idx) override
     {
@@ -270,12 +873,24 @@ struct Abacus {
     int _fgpt_per_bucket;
     // bool _bamboo_implementation; // true = BambooOverflow, false = Bamboo
     bool _dif_hash;
+    /* Passed on to the layers, see BambooBase::_hash_once */
+    bool _hash_once;
+    HashPolicy _hash_policy;
     /* Used if *dif_hash == false* to initialize each individual layer */
     u32 _seed;
     u32 _alt_seed;
+    /* Draws the seeds of the layers if *dif_hash* */
+    FastRand _rng;
 
     Abacus(int max_depth, int bucket_idx_len, int fgpt_size, 
-            int fgpt_per_bucket, int seg_idx_base, bool _dif_hash);
+            int fgpt_per_bucket, int seg_idx_base, bool _dif_hash,
+            bool hash_once = false, HashPolicy hash_policy = HASH_SPOOKY);
+    /* With explicit seeds the layers and their eviction order follow from
+     * *seed* and *alt_seed* alone */
+    Abacus(int max_depth, int bucket_idx_len, int fgpt_size, 
+            int fgpt_per_bucket, int seg_idx_base, bool _dif_hash,
+            u32 seed, u32 alt_seed, bool hash_once = false, 
+            HashPolicy hash_policy = HASH_SPOOKY);
     // Abacus(int base_expn, vector<int> num_segments, vector<int> buckets_per_segment,
     //         vector<int> fgpt_size, vector<int> fgpt_per_bucket);
     ~Abacus();
@@ -283,9 +898,54 @@ struct Abacus {
     int count(int elt);
     void increment(int elt);
     void decrement(int elt);
+    int count(u64 key);
+    void increment(u64 key);
+    void decrement(u64 key);
+    int count(std::string_view key);
+    void increment(std::string_view key);
+    void decrement(std::string_view key);
+    /* Other integer types, see OtherIntKey */
+    template <typename T, OtherIntKey<T> = 0>
+    inline int count(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return count((int) key);
+        else
+            return count((u64) key);
+    }
+    template <typename T, OtherIntKey<T> = 0>
+    inline void increment(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            increment((int) key);
+        else
+            increment((u64) key);
+    }
+    template <typename T, OtherIntKey<T> = 0>
+    inline void decrement(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            decrement((int) key);
+        else
+            decrement((u64) key);
+    }
+    /* Every layer sees the same *hash*, so with *dif_hash* the layers only
+     * differ by their offset */
+    int count_hash(u64 hash);
+    void increment_hash(u64 hash);
+    void decrement_hash(u64 hash);
+
+    template <typename Key> int _count(Key key);
+    template <typename Key> void _increment(Key key);
+    template <typename Key> void _decrement(Key key);
     
     void add_layer();
 
+    /* Reserves the first layer for *expected_items* distinct keys, see
+     * Bamboo::reserve. The layers above only hold keys counted more than
+     * once, and grow on demand */
+    void reserve(u64 expected_items, double target_load = 0.85);
+
     u32 occupancy();
 
     void dump_abacus();  
@@ -0,0 +1,109 @@
+#ifndef BAMBOO_CONCURRENT
+#define BAMBOO_CONCURRENT
+
+#include <atomic>
+#include <mutex>
+
+#include "bamboo.hpp"
+
+
+/* A writer lock and the sequence number readers validate against, for the
+ * segments whose index maps to it. One per cache line */
+struct alignas(64) LockStripe {
+    std::mutex lock;
+    std::atomic<u64> seq{0};
+};
+
+
+/* Bamboo whose key API (count, insert, remove and their variants) may run
+ * from any number of threads.
+ *
+ * Writers lock the stripe of their segment, index modulo STRIPES, and
+ * keep its sequence number odd while they write. Writers of different
+ * segments run in parallel: a cuckoo chain never leaves its segment.
+ * Readers take no lock. They read the sequence number, count, and retry 
+ * if it moved in the meantime (a seqlock).
+ *
+ * A split also takes *_split_mutex* and holds the filter-wide *_version*
+ * odd, which readers and writers check around their directory lookup.
+ * Writers already inside other segments continue, as a split only touches
+ * its own segment, the new half and the directory. Lookups go through a
+ * copy of the directory with atomic entries; when it doubles, the old 
+ * copy is kept until destruction, since readers may still be in it.
+ *
+ * Keep the defaults of _lazy_split, _bfs_cuckoo and _expand_policy, and
+ * do not pack() or attach a BackgroundExpander. reserve(), build(), 
+ * shrink(), occupancy(), capacity() and the dump methods need a quiescent
+ * filter; build() inserts without the stripe locks. *stats* are 
+ * approximate under concurrent writers. */
+struct ConcurrentBamboo : Bamboo {
+    static const u32 STRIPES = 1024;
+    LockStripe *_stripes;
+    std::atomic<u64> _version;
+    std::recursive_mutex _split_mutex;
+    /* The directory as readers see it, see _publish_directory() */
+    std::atomic<std::atomic<Segment*>*> _reader_dir;
+    std::atomic<u32> _reader_mask;
+    u32 _reader_dir_size;
+    vector<std::atomic<Segment*>*> _retired_dirs;
+    /* Seeds the writers' victim choices, see thread_rand() */
+    u64 _victim_seed;
+
+    ConcurrentBamboo(int bucket_idx_len, int fgpt_size, 
+            int fgpt_per_bucket, int seg_idx_base);
+    ConcurrentBamboo(int bucket_idx_len, int fgpt_size, 
+            int fgpt_per_bucket, int seg_idx_base, 
+            u32 seed, u32 alt_seed);
+    ~ConcurrentBamboo();
+
+    using Bamboo::count;
+    using Bamboo::insert;
+    using Bamboo::remove;
+    using Bamboo::contains;
+    int count(int elt) override;
+    bool insert(int elt) override;
+    bool remove(int elt) override;
+    int count_hash(u64 hash) override;
+    /* count() > 0, which _read() validates */
+    bool contains(int elt) override;
+    bool contains_hash(u64 hash) override;
+    bool insert_hash(u64 hash) override;
+    bool remove_hash(u64 hash) override;
+    /* One count() per key: the pipelined passes of BambooBase::count_batch
+     * do not validate against the seqlocks */
+    void count_batch(const int *keys, size_t n, u32 *counts) override;
+    void count_batch(const u64 *keys, size_t n, u32 *counts) override;
+    void contains_batch(const int *keys, size_t n, bool *found) override;
+    void contains_batch(const u64 *keys, size_t n, bool *found) override;
+    /* One insert() per key, the grouped runs of Bamboo::insert_batch would
+     * hold no stripe lock */
+    size_t insert_batch(const int *keys, size_t n) override;
+    size_t insert_batch(const u64 *keys, size_t n) override;
+    int shrink();
+
+    /* *extract* fills in fgpt, seg_idx, segment and the buckets of the 
+     * key, like BambooBase::_extract */
+    template <typename Extract> 
+    int _read(Extract extract);
+    template <typename Extract, typename Op> 
+    bool _write(Extract extract, Op op);
+
+    inline Segment *_get_segment(u32 hashfrag, u32 &seg_idx) override
+    {
+        /* The mask is published after the array it fits */
+        u32 mask = _reader_mask.load(std::memory_order_acquire);
+        Segment *s = _reader_dir.load(std::memory_order_acquire)
+            [hashfrag & mask].load(std::memory_order_relaxed);
+        seg_idx = hashfrag & ((1u << _local_depth(s)) - 1);
+        return s;
+    }
+    void _set_segment(u32 seg_idx, u32 depth, Segment *segment) override;
+    void _publish_directory();
+
+    bool overflow(Segment *segment, u32 seg_idx, u32 bi_main, 
+            u32 bi_alt, u32 fgpt, u32 fgpt_cnt) override;
+    u32 _victim_slot() override;
+};
+
+
+#endif
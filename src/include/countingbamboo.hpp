@@ -8,8 +8,11 @@
 #include <iostream>
 #include <exception>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "SpookyV2.h"
+#include "fastrand.hpp"
 
 using std::vector, std::unordered_map, std::bitset;
 using std::cout, std::endl, std::cerr, std::flush;
@@ -22,19 +25,15 @@ typedef uint8_t u8;
 
 struct BucketCounter {
     u8 *_bits;    /* Each fgpt is stored in a contiguous subarray along with
-                   * a flag bit. See implementation for details */
-    u16 _len;     /* Length of array allocated to *_bits* */
+                   * a flag bit. See implementation for details. The array
+                   * lives in the slab of the owning SegmentCounter. */
+    u16 _len;     /* Length of the array at *_bits* */
     u8 _entry_size;
     u8 _step;
 
-    BucketCounter(u8 fgpt_size) {_entry_size = fgpt_size + 8; 
-                          _step = (_entry_size + 7) / 8;}
-    ~BucketCounter() { delete[] _bits; }
-
-    /* Must be called after initialization to allocate the array.
-     * This is here because I have yet to study copy-semantics, and
-     * including this directly in the constructor gives issues. */
-    void initialize(int capacity, int fgpt_size);
+    /* Buckets are lightweight views handed out by SegmentCounter::bucket() */
+    BucketCounter(u8 *bits, u16 len, u8 entry_size, u8 step) :
+            _bits(bits), _len(len), _entry_size(entry_size), _step(step) {}
 
     bool _occupied_idx (int idx);
     int _vacant_idx();
@@ -62,8 +61,20 @@ struct BucketCounter {
     void add_at(int idx, int d);
     void sub_at(int idx, int d);
 
+    /* Calls visit(fgpt, count) on every occupied slot. Prefer this to
+     * retrieve_all(), which allocates per slot */
+    template <typename F>
+    inline void for_each(F &&visit)
+    {
+        u32 cnt;
+        for (u32 idx = 0; idx < _len/_step; ++idx) {
+            if ((cnt = _bits[idx*_step]))
+                visit(get_fgpt_at(idx), cnt);
+        }
+    }
+
     vector<vector<u32>> retrieve_all();
-    void split_bucket(BucketCounter &dst, int sep_lvl);
+    void split_bucket(BucketCounter dst, int sep_lvl);
     u32 occupancy();
 
     void dump_bucket();
@@ -72,22 +83,28 @@ struct BucketCounter {
 
 
 struct SegmentCounter {
-    vector<BucketCounter> buckets;
+    u8 *_slab;          /* Storage of all buckets, back to back. Starts on
+                         * a cache line; buckets of a power of two bytes
+                         * then never straddle two, others (6 or 12 bytes)
+                         * may */
+    u16 _bucket_len;    /* Bytes per bucket */
+    u8 _entry_size;
+    u8 _step;
+    u8 fgpt_size;
+    int num_buckets;
     SegmentCounter *overflow;
     int expansion_count;
-    u8 fgpt_size;
     
-    SegmentCounter(int num_buckets, int fgpt_size, int fgpt_per_bucket, int expansion__count) :
-            expansion_count(expansion__count),
-            fgpt_size(fgpt_size)
+    SegmentCounter(int num_buckets, int fgpt_size, int fgpt_per_bucket, 
+            int expansion__count);
+    ~SegmentCounter();
+    SegmentCounter(const SegmentCounter &) = delete;
+    SegmentCounter &operator=(const SegmentCounter &) = delete;
+
+    inline BucketCounter bucket(u32 idx)
     {
-        if (fgpt_size != 7 && fgpt_size != 15 && fgpt_size != 23)
-            throw std::runtime_error("Fgpt size not supported");
-        buckets = vector<BucketCounter>(num_buckets, fgpt_size);
-        overflow = nullptr;
-        for (int i=0; i<num_buckets; ++i) {
-            buckets[i].initialize(fgpt_per_bucket, fgpt_size);
-        }
+        return BucketCounter(_slab + idx * _bucket_len, _bucket_len, 
+            _entry_size, _step);
     }
 
     u32 occupancy();
@@ -112,6 +129,22 @@ struct BitTrieCounter {
 };
 
 
+/* A key of CountingBamboo::insert_batch, hashed but not placed yet. See
+ * BambooBaseCounter::_route */
+struct RoutedKeyCounter {
+    u32 fgpt;
+    u32 hashfrag;
+    u32 bidx1;
+};
+
+
+/* Integer key types other than int and u64, see OtherIntKey in 
+ * bamboo.hpp */
+template <typename T>
+using OtherIntKeyCounter = std::enable_if_t<std::is_integral_v<T> 
+    && !std::is_same_v<T, int> && !std::is_same_v<T, u64>, int>;
+
+
 struct BambooBaseCounter {
     int _num_segments;
     int _bucket_idx_len;
@@ -123,6 +156,9 @@ struct BambooBaseCounter {
     u32 _seed;
     u32 _alt_seed;
     u32 _bucket_mask;
+    /* Picks eviction victims. Seeded from *_seed* and *_alt_seed*; reseed
+     * it for a different eviction order under the same hashes */
+    FastRand _rng;
 
     u32 _chain_max = 500;
 
@@ -154,26 +190,124 @@ struct BambooBaseCounter {
             u32 bidx1, u32 bidx2);
     bool remove(int elt);
 
+    /* 64-bit and byte-string keys, hashed once to 64 bits with SpookyHash.
+     * See BambooBase for the layout. The key type selects the hash, 
+     * insert(5) and insert((u64) 5) are different keys */
+    inline int count(u64 key) { return count_hash(_compute_hash64(key)); }
+    inline bool insert(u64 key) { return insert_hash(_compute_hash64(key)); }
+    inline bool remove(u64 key) { return remove_hash(_compute_hash64(key)); }
+    inline int count(std::string_view key) 
+    { 
+        return count_hash(_compute_hash64(key)); 
+    }
+    inline bool insert(std::string_view key) 
+    { 
+        return insert_hash(_compute_hash64(key)); 
+    }
+    inline bool remove(std::string_view key) 
+    { 
+        return remove_hash(_compute_hash64(key)); 
+    }
+
+    /* Other integer types: up to 32 bits they are int keys, wider ones
+     * u64 keys */
+    template <typename T, OtherIntKeyCounter<T> = 0>
+    inline int count(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return count((int) key);
+        else
+            return count((u64) key);
+    }
+    template <typename T, OtherIntKeyCounter<T> = 0>
+    inline bool insert(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return insert((int) key);
+        else
+            return insert((u64) key);
+    }
+    template <typename T, OtherIntKeyCounter<T> = 0>
+    inline bool remove(T key)
+    {
+        if constexpr (sizeof(T) <= 4)
+            return remove((int) key);
+        else
+            return remove((u64) key);
+    }
+
+    /* For callers that already hold a good 64-bit hash of the key */
+    int count_hash(u64 hash);
+    bool insert_hash(u64 hash);
+    bool remove_hash(u64 hash);
+    inline bool contains_hash(u64 hash) { return count_hash(hash) > 0; }
+
+    int _count_extracted(u32 fgpt, SegmentCounter *segment, u32 bidx1,
+            u32 bidx2);
+    bool _remove_extracted(u32 fgpt, SegmentCounter *segment, u32 bidx1,
+            u32 bidx2);
+
     bool _cuckoo(SegmentCounter *segment, u32 seg_idx, u32 bi_main, u32 bi_alt, 
             u32 fgpt, u32 fgpt_cnt, u32 chain_len);
     // u32 _find_segment_idx(u32 hash);
+    /* The part of _extract() that only needs the hash: the fgpt, the
+     * hash fragment _get_segment() takes and the main bucket */
+    inline void _route(int elt, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        u32 hash = _compute_hash(elt);
+        fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+            & ((1<<_fgpt_size) - 1);
+        /* Rehash while the fingerprint is all zeros */
+        while (!fgpt) {
+            hash = _compute_hash(hash);
+            fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+                & ((1<<_fgpt_size) - 1);
+        }
+        hashfrag = hash >> _bucket_idx_len;
+        bidx1 = hash & _bucket_mask;
+    }
+    inline void _route(u64 key, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        _route_hash(_compute_hash64(key), fgpt, hashfrag, bidx1);
+    }
+    inline void _route_hash(u64 hash, u32 &fgpt, u32 &hashfrag, u32 &bidx1)
+    {
+        hash >>= _offset;
+        fgpt = (hash >> (_bucket_idx_len + _seg_idx_base))
+            & ((1<<_fgpt_size) - 1);
+        if (!fgpt)
+            fgpt = 1 << (_fgpt_size - 1);
+        hashfrag = (fgpt << _seg_idx_base)
+            | ((hash >> _bucket_idx_len) & ((1<<_seg_idx_base) - 1));
+        bidx1 = hash & _bucket_mask;
+    }
     bool _extract(int elt, u32 &fgpt, u32 &seg_idx, SegmentCounter *&segment,
             u32 &bidx1, u32 &bidx2); 
+    bool _extract_hash(u64 hash, u32 &fgpt, u32 &seg_idx, 
+            SegmentCounter *&segment, u32 &bidx1, u32 &bidx2); 
 
     inline u32 _alt_bucket(u32 fgpt, u32 bidx)
     {
-        u32 alt = fgpt;
-        while (true) {
-            alt = (_h.Hash32(&alt, 4, _alt_seed) >> _offset) & _bucket_mask;
-            if (alt)
-                break;
-        }
-        return (bidx ^ alt) & _bucket_mask;
+        u32 alt = (_h.Hash32(&fgpt, 4, _alt_seed) >> _offset) & _bucket_mask;
+        /* Rehashing a zero offset can cycle on 0 for some seeds */
+        return (bidx ^ (alt ? alt : 1)) & _bucket_mask;
     }
     inline u32 _compute_hash(int elt)
     {
         return _h.Hash32(&elt, 4, _seed) >> _offset;
     }
+    inline u64 _compute_hash64(u64 key)
+    {
+        return _h.Hash64(&key, 8, _seed);
+    }
+    inline u64 _compute_hash64(std::string_view key)
+    {
+        return _h.Hash64(key.data(), key.size(), _seed);
+    }
+
+    /* Number of segment index bits that hold *expected_items* at no more
+     * than *target_load* of the slots, at least *_seg_idx_base* */
+    u32 _reserve_depth(u64 expected_items, double target_load);
 
     virtual SegmentCounter *_get_segment(u32 hash, u32 &seg_idx) = 0;
     virtual bool overflow(SegmentCounter *segment, u32 seg_idx, u32 bi_main, 
@@ -210,6 +344,21 @@ struct CountingBamboo : BambooBaseCounter {
         return s;
     }
 
+    /* Splits *segment* in two by the next bit of the fgpts. The low half
+     * stays in *segment* at index *seg_idx*; returns the high half */
+    SegmentCounter *split(SegmentCounter *segment, u32 seg_idx);
+
+    /* Splits segments up front until *expected_items* fit at 
+     * *target_load*, see Bamboo::reserve */
+    void reserve(u64 expected_items, double target_load = 0.85);
+
+    /* Inserts *keys[0..n)* like insert() on each, and returns how many 
+     * went in. The keys are radix sorted by segment index first, see 
+     * Bamboo::insert_batch */
+    size_t insert_batch(const int *keys, size_t n);
+    size_t insert_batch(const u64 *keys, size_t n);
+    template <typename Key> size_t _insert_batch(const Key *keys, size_t n);
+
     bool overflow(SegmentCounter *segment, u32 seg_idx, u32 bi_main, 
             u32 bi_alt, u32 fgpt, u32 fgpt_cnt) override;
 
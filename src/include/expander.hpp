@@ -0,0 +1,48 @@
+#ifndef BAMBOO_EXPANDER
+#define BAMBOO_EXPANDER
+
+#include <thread>
+#include <condition_variable>
+
+#include "bamboo.hpp"
+
+
+/* Moves expansion work of a Bamboo or BambooOverflow to a worker thread.
+ *
+ * Bamboo: inserts and removes keep an approximate per-segment load. A
+ * segment reaching *_presplit_load* of its slots is queued, and the worker
+ * splits it before cuckoo chains start failing in it. The worker also
+ * migrates the buckets of lazy splits (see Bamboo::_lazy_split), which is
+ * the setting that keeps each worker step short.
+ * BambooOverflow: the paced expand() calls are left to the worker.
+ *
+ * Synchronization: while attached, every call of the key API (count,
+ * insert, remove and their variants) holds *_mutex* for its duration, and
+ * the worker holds it for one step at a time: one split or *_split_step*
+ * bucket migrations. Lookups therefore never see a half-done step, and
+ * can run from any thread. Other methods (occupancy, pack, ...) must not
+ * run concurrently with the key API.
+ *
+ * Attach to a filter that is not in use, and destroy the expander before
+ * the filter; the destructor finishes the queued work on the caller's
+ * thread. */
+struct BackgroundExpander {
+    BambooBase *_filter;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _pending;
+    bool _stop;
+    std::thread _worker;
+
+    BackgroundExpander(BambooBase *filter);
+    ~BackgroundExpander();
+    BackgroundExpander(const BackgroundExpander &) = delete;
+    BackgroundExpander &operator=(const BackgroundExpander &) = delete;
+
+    /* Wakes the worker up. Called by the filter with *_mutex* held */
+    void notify();
+    void _run();
+};
+
+
+#endif
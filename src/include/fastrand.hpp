@@ -0,0 +1,52 @@
+#ifndef FASTRAND
+#define FASTRAND
+
+#include <cstdint>
+#include <atomic>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+
+/* wyrand: a 64-bit counter mixed by one 128-bit multiply. Each filter owns
+ * one for its eviction choices, so filters neither share the hidden lock of
+ * rand() nor each other's sequence, and a filter built from explicit seeds
+ * evicts the same way on every run. */
+struct FastRand {
+    u64 _state;
+
+    FastRand(u64 seed = 0) : _state(seed) {}
+
+    inline void seed(u64 seed)
+    {
+        _state = seed;
+    }
+
+    inline u64 next()
+    {
+        _state += 0xa0761d6478bd642full;
+        __uint128_t m = (__uint128_t) _state * (_state ^ 0xe7037ed1a0b428dbull);
+        return (u64) (m >> 64) ^ (u64) m;
+    }
+
+    /* Uniform in [0, n), by multiply-shift instead of a division */
+    inline u32 below(u32 n)
+    {
+        return ((next() >> 32) * n) >> 32;
+    }
+};
+
+
+/* The calling thread's generator, for writers that run at once and so
+ * cannot share a filter's. A thread seeds it on first use from *seed*,
+ * which the filter draws from its own, and the order in which threads 
+ * first asked; all filters a thread writes to share it */
+inline FastRand &thread_rand(u64 seed)
+{
+    static std::atomic<u64> threads(0);
+    static thread_local FastRand rng(
+        seed + threads++ * 0x9e3779b97f4a7c15ull);
+    return rng;
+}
+
+#endif
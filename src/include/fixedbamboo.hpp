@@ -0,0 +1,180 @@
+#ifndef FIXED_BAMBOO
+#define FIXED_BAMBOO
+
+#include "bamboo.hpp"
+#include "probe.hpp"
+
+
+/* Compile-time specialized bucket probes. Same layout as Bucket, but the
+ * fgpt size and the number of slots are template parameters, so the
+ * strides, masks and loop bounds are constants and the probes unroll. */
+template <int FgptBits, int SlotsPerBucket>
+struct FixedBucket {
+    static_assert(FgptBits == 7 || FgptBits == 15 || FgptBits == 23,
+        "Fgpt size not supported");
+    static_assert(SlotsPerBucket > 0 && SlotsPerBucket <= 64,
+        "At most 64 fgpts per bucket supported");
+
+    static constexpr int Step = (FgptBits + 7) / 8;
+    static constexpr int Len = Step * SlotsPerBucket;
+
+    static inline u32 entry_at(const u8 *bits, int idx)
+    {
+        u32 entry = 0;
+        for (int i = 0; i < Step; ++i)
+            entry |= bits[idx*Step + i] << (8*i);
+        return entry;
+    }
+
+    /* Bit i is set iff (entry_i & mask) == key */
+    static inline u64 probe(const u8 *bits, u32 key, u32 mask)
+    {
+        if constexpr (Step == 1) {
+            return probe8(bits, SlotsPerBucket, key, mask);
+        } else if constexpr (Step == 2) {
+            return probe16(bits, SlotsPerBucket, key, mask);
+        } else {
+            u64 r = 0;
+            for (int idx = 0; idx < SlotsPerBucket; ++idx)
+                r |= (u64) ((entry_at(bits, idx) & mask) == key) << idx;
+            return r;
+        }
+    }
+
+    static inline u64 match_fgpt(const u8 *bits, u32 fgpt)
+    {
+        constexpr u32 mask = ((1u << (8*Step)) - 1) & ~1u;
+        return fgpt ? probe(bits, fgpt << 1, mask) : 0;
+    }
+
+    static inline u64 flag_mask(const u8 *bits)
+    {
+        return probe(bits, 1, 1);
+    }
+
+    static inline u64 vacant_mask(const u8 *bits)
+    {
+        return probe(bits, 0, (1u << (8*Step)) - 1);
+    }
+
+    static inline int count_fgpt(const u8 *bits, u32 fgpt)
+    {
+        u64 match = match_fgpt(bits, fgpt);
+        if (!match)
+            return 0;
+        return __builtin_popcountll(match)
+            + __builtin_popcountll(match & flag_mask(bits));
+    }
+
+    /* Adds one copy of *fgpt*. Returns false if the bucket has no room */
+    static inline bool insert_fgpt(u8 *bits, u32 fgpt)
+    {
+        u64 single = match_fgpt(bits, fgpt);
+        if (single)
+            single &= ~flag_mask(bits);
+        if (single) {
+            ++bits[__builtin_ctzll(single) * Step];
+            return true;
+        }
+        u64 vacant = vacant_mask(bits);
+        if (!vacant)
+            return false;
+        u32 entry = fgpt << 1;
+        int idx = __builtin_ctzll(vacant);
+        for (int i = 0; i < Step; ++i) {
+            bits[idx*Step + i] = (u8) entry;
+            entry >>= 8;
+        }
+        return true;
+    }
+
+    /* Removes one copy of *fgpt*. Returns false if it is not stored */
+    static inline bool remove_fgpt(u8 *bits, u32 fgpt)
+    {
+        u64 match = match_fgpt(bits, fgpt);
+        if (!match)
+            return false;
+        int idx = __builtin_ctzll(match);
+        if (bits[idx*Step] & 1) {
+            --bits[idx*Step];
+        } else {
+            for (int i = 0; i < Step; ++i)
+                bits[idx*Step + i] = 0;
+        }
+        return true;
+    }
+};
+
+
+/* Bamboo with the fgpt size and bucket width fixed at compile time. The
+ * hot paths (count, insert, remove) use FixedBucket directly on the slab;
+ * cuckoo chains and splits go through the runtime Bamboo code, which
+ * shares the layout. Use make_bamboo() to pick an instantiation from
+ * runtime parameters. */
+template <int FgptBits, int SlotsPerBucket>
+struct BambooFixed : Bamboo {
+    typedef FixedBucket<FgptBits, SlotsPerBucket> FB;
+
+    /* Takes the Bamboo constructor arguments minus the fgpt size and
+     * fgpts per bucket, eg. (bucket_idx_len, seg_idx_base, offset) */
+    template <typename... Args>
+    BambooFixed(int bucket_idx_len, int seg_idx_base, Args... args) :
+            Bamboo(bucket_idx_len, FgptBits, SlotsPerBucket, seg_idx_base,
+                args...) {}
+
+    using Bamboo::insert;
+
+    inline u8 *_bucket_bits(Segment *segment, u32 bidx)
+    {
+        return segment->_slab + bidx * FB::Len;
+    }
+
+    int _count_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+            u32 bidx2) override
+    {
+        if (segment->_packed || segment->_split)
+            return _count_segment(segment, fgpt, bidx1, bidx2);
+        int count = FB::count_fgpt(_bucket_bits(segment, bidx1), fgpt)
+            + FB::count_fgpt(_bucket_bits(segment, bidx2), fgpt);
+        if (segment->_stash_len)
+            count += segment->count_stash(bidx1, bidx2, fgpt);
+        return count;
+    }
+
+    bool _contains_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+            u32 bidx2) override
+    {
+        if (segment->_packed || segment->_split)
+            return _contains_segment(segment, fgpt, bidx1, bidx2);
+        return FB::match_fgpt(_bucket_bits(segment, bidx1), fgpt)
+            || FB::match_fgpt(_bucket_bits(segment, bidx2), fgpt)
+            || (segment->_stash_len 
+                && segment->count_stash(bidx1, bidx2, fgpt));
+    }
+
+    bool insert(int elt, u32 fgpt, u32 seg_idx, Segment *segment,
+            u32 bidx1, u32 bidx2) override
+    {
+        segment->settle(bidx1);
+        segment->settle(bidx2);
+        return FB::insert_fgpt(_bucket_bits(segment, bidx1), fgpt)
+            || FB::insert_fgpt(_bucket_bits(segment, bidx2), fgpt)
+            || _cuckoo(segment, seg_idx, bidx1, bidx2, fgpt, 1, 1);
+    }
+
+    bool _remove_extracted(u32 fgpt, Segment *segment, u32 bidx1, 
+            u32 bidx2) override
+    {
+        if (segment->_packed)
+            segment->unpack();
+        segment->settle(bidx1);
+        segment->settle(bidx2);
+        return FB::remove_fgpt(_bucket_bits(segment, bidx1), fgpt)
+            || FB::remove_fgpt(_bucket_bits(segment, bidx2), fgpt)
+            || (segment->_stash_len 
+                && segment->remove_stash(bidx1, bidx2, fgpt));
+    }
+};
+
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef BAMBOO_INTERLEAVE
+#define BAMBOO_INTERLEAVE
+
+#include "bamboo.hpp"
+
+/* Coroutine-interleaved lookups. Needs C++20 (-std=c++20); without
+ * coroutine support the header declares nothing, and count_batch() is the
+ * way to overlap lookups. */
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+
+/* Recycles coroutine frames, which all have the size of the one lookup
+ * coroutine, so that starting a lookup does not go to malloc */
+struct FramePool {
+    static const size_t MAX_FREE = 256;
+    size_t size = 0;
+    vector<void*> free;
+
+    ~FramePool()
+    {
+        for (void *p : free)
+            ::operator delete(p);
+    }
+    inline void *get(size_t n)
+    {
+        if (n != size || free.empty())
+            return ::operator new(n);
+        void *p = free.back();
+        free.pop_back();
+        return p;
+    }
+    inline void put(void *p, size_t n)
+    {
+        if (!size)
+            size = n;
+        if (n == size && free.size() < MAX_FREE)
+            free.push_back(p);
+        else
+            ::operator delete(p);
+    }
+    static inline FramePool &local()
+    {
+        static thread_local FramePool pool;
+        return pool;
+    }
+};
+
+
+/* A lookup that suspends after each prefetch, see count_interleaved().
+ * It starts suspended and keeps its frame after finishing, until the
+ * owner reads *result* and destroys it */
+struct LookupTask {
+    struct promise_type {
+        int result;
+
+        LookupTask get_return_object()
+        {
+            return LookupTask{
+                std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(int count) { result = count; }
+        void unhandled_exception() { throw; }
+
+        static void *operator new(size_t n)
+        {
+            return FramePool::local().get(n);
+        }
+        static void operator delete(void *p, size_t n)
+        {
+            FramePool::local().put(p, n);
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+
+/* count() of one key, in the steps of _extract(), _get_segment() and the
+ * bucket probes, suspending wherever the next step would wait on memory */
+template <typename Key>
+LookupTask _count_coro(BambooBase *bbf, Key key)
+{
+    u32 fgpt, hashfrag, bidx1, seg_idx;
+    bbf->_route(key, fgpt, hashfrag, bidx1);
+    bbf->_prefetch_route(hashfrag);
+    co_await std::suspend_always{};
+
+    Segment *segment = bbf->_get_segment(hashfrag, seg_idx);
+    u32 bidx2 = bbf->_alt_bucket(fgpt, bidx1);
+    if (!segment->_packed) {
+        __builtin_prefetch(segment->_slab + bidx1 * segment->_bucket_len);
+        __builtin_prefetch(segment->_slab + bidx2 * segment->_bucket_len);
+        co_await std::suspend_always{};
+    }
+    co_return bbf->_count_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+
+/* Counts of *keys[0..n)* into *out*, as count() on each would give, with
+ * up to *group* lookups in flight. Each turn resumes the lookups round
+ * robin; one that finishes hands its slot to the next key. *Out* is u32
+ * for counts or bool for contains. Locks the filter for the whole call,
+ * like one count() would; not for ConcurrentBamboo, whose lookups
+ * validate against its seqlocks */
+template <typename Key, typename Out>
+void count_interleaved(BambooBase *bbf, const Key *keys, size_t n, Out *out,
+        int group)
+{
+    static const int GROUP_MAX = 64;
+    group = std::clamp(group, 1, GROUP_MAX);
+    std::coroutine_handle<LookupTask::promise_type> task[GROUP_MAX];
+    size_t idx[GROUP_MAX];
+
+    OpGuard guard(bbf->_op_mutex);
+    size_t next = 0;
+    int active = 0;
+    try {
+        for (; active < group && next < n; ++active, ++next) {
+            task[active] = _count_coro(bbf, keys[next]).handle;
+            idx[active] = next;
+        }
+        while (active) {
+            for (int i = 0; i < active; ) {
+                task[i].resume();
+                if (!task[i].done()) {
+                    ++i;
+                    continue;
+                }
+                out[idx[i]] = task[i].promise().result;
+                task[i].destroy();
+                task[i] = nullptr;
+                if (next < n) {
+                    task[i] = _count_coro(bbf, keys[next]).handle;
+                    idx[i] = next++;
+                    ++i;
+                } else {
+                    /* Keep the slots in flight contiguous */
+                    --active;
+                    task[i] = task[active];
+                    idx[i] = idx[active];
+                }
+            }
+        }
+    } catch (...) {
+        /* A lookup that threw is at its final suspend point, and a slot 
+         * whose next frame failed to allocate is empty */
+        for (int i = 0; i < active; ++i) {
+            if (task[i])
+                task[i].destroy();
+        }
+        throw;
+    }
+}
+
+#endif
+#endif
@@ -0,0 +1,111 @@
+#ifndef PROBE
+#define PROBE
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+
+/* Vectorized slot probes used by the buckets. A bucket of *n* slots of one
+ * or two bytes each is compared against a single key in one pass: bit i of
+ * the returned mask is set iff (slot_i & *mask*) == *key*.
+ * Buckets are limited to 64 slots so the result fits in one word. */
+
+
+/* Scalar fallback, also used for the tail that does not fill a vector */
+inline u64 _probe8_scalar(const u8 *bits, int from, int n, u8 key, u8 mask)
+{
+    u64 r = 0;
+    for (int i = from; i < n; ++i)
+        r |= (u64) ((bits[i] & mask) == key) << i;
+    return r;
+}
+
+inline u64 _probe16_scalar(const u8 *bits, int from, int n, u16 key, u16 mask)
+{
+    u64 r = 0;
+    u16 slot;
+    for (int i = from; i < n; ++i) {
+        slot = bits[2*i] | (bits[2*i+1] << 8);
+        r |= (u64) ((slot & mask) == key) << i;
+    }
+    return r;
+}
+
+
+/* 7-bit layout: one byte per slot */
+inline u64 probe8(const u8 *bits, int n, u8 key, u8 mask)
+{
+    u64 r = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i k32 = _mm256_set1_epi8(key);
+    const __m256i m32 = _mm256_set1_epi8(mask);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (bits + i));
+        v = _mm256_cmpeq_epi8(_mm256_and_si256(v, m32), k32);
+        r |= (u64) (u32) _mm256_movemask_epi8(v) << i;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i k16 = _mm_set1_epi8(key);
+    const __m128i m16 = _mm_set1_epi8(mask);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (bits + i));
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, m16), k16);
+        r |= (u64) _mm_movemask_epi8(v) << i;
+    }
+    if (i + 8 <= n) {
+        __m128i v = _mm_loadl_epi64((const __m128i *) (bits + i));
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, m16), k16);
+        r |= (u64) (_mm_movemask_epi8(v) & 0xFF) << i;
+        i += 8;
+    }
+#endif
+    return r | _probe8_scalar(bits, i, n, key, mask);
+}
+
+
+/* 15-bit layout: two little-endian bytes per slot */
+inline u64 probe16(const u8 *bits, int n, u16 key, u16 mask)
+{
+    u64 r = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i k32 = _mm256_set1_epi16(key);
+    const __m256i m32 = _mm256_set1_epi16(mask);
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (bits + 2*i));
+        v = _mm256_cmpeq_epi16(_mm256_and_si256(v, m32), k32);
+        /* Packing works per 128-bit lane: slots 0-7 land in bits 0-7 and
+         * slots 8-15 in bits 16-23 of the byte mask */
+        u32 m = _mm256_movemask_epi8(_mm256_packs_epi16(v, _mm256_setzero_si256()));
+        r |= (u64) ((m & 0xFF) | ((m >> 8) & 0xFF00)) << i;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i k16 = _mm_set1_epi16(key);
+    const __m128i m16 = _mm_set1_epi16(mask);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (bits + 2*i));
+        v = _mm_cmpeq_epi16(_mm_and_si128(v, m16), k16);
+        r |= (u64) (_mm_movemask_epi8(_mm_packs_epi16(v, _mm_setzero_si128())) & 0xFF) << i;
+    }
+    if (i + 4 <= n) {
+        __m128i v = _mm_loadl_epi64((const __m128i *) (bits + 2*i));
+        v = _mm_cmpeq_epi16(_mm_and_si128(v, m16), k16);
+        r |= (u64) (_mm_movemask_epi8(_mm_packs_epi16(v, _mm_setzero_si128())) & 0xF) << i;
+        i += 4;
+    }
+#endif
+    return r | _probe16_scalar(bits, i, n, key, mask);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef SEMISORT
+#define SEMISORT
+
+#include <cstdint>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+
+/* Semi-sorted encoding of 4-slot buckets, as in the 2014 Cuckoo filter
+ * paper. The entries (fgpt plus flag bit, 0 if empty) of a bucket are
+ * sorted, and their top 4 bits are replaced by the index of the sorted
+ * nibble quadruple: there are only 3876 of them, so 12 bits instead of 16.
+ * The remaining low bits are stored as they are. This saves one bit per
+ * entry: a bucket of 8-bit entries takes 28 bits, of 16-bit entries 60.
+ *
+ * Packed buckets are laid out back to back in a bit array; the array must
+ * be padded by *PAD* bytes since buckets are accessed with 16-byte loads.
+ */
+struct SemiSortedBucket {
+    static constexpr int SLOTS = 4;
+    static constexpr int PAD = 16;
+    static constexpr int NUM_PREFIXES = 3876;
+
+    static inline int bucket_bits(int entry_bits)
+    {
+        return 12 + SLOTS * (entry_bits - 4);
+    }
+
+    static void encode(const u32 *entries, int entry_bits, u8 *packed,
+            u64 bit_offset);
+    static void decode(const u8 *packed, u64 bit_offset, int entry_bits,
+            u32 *entries);
+    /* Copies of *fgpt* in the packed bucket, flag bit included */
+    static int count_fgpt(const u8 *packed, u64 bit_offset, int entry_bits,
+            u32 fgpt);
+    static int occupancy(const u8 *packed, u64 bit_offset, int entry_bits);
+};
+
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef BAMBOO_SHARDED
+#define BAMBOO_SHARDED
+
+#include <atomic>
+#include <thread>
+
+#include "bamboo.hpp"
+
+
+/* One operation queued for a shard. *result* receives the count of a
+ * lookup and is null for inserts and removes */
+struct ShardOp {
+    u64 hash;
+    u32 *result;
+    u32 op;
+};
+
+
+/* Single-producer single-consumer ring of ShardOps. Head and tail live on
+ * their own cache lines */
+struct ShardQueue {
+    static const u32 SIZE = 1 << 12;
+    alignas(64) std::atomic<u32> head{0};    /* Next to pop, by the worker */
+    alignas(64) std::atomic<u32> tail{0};    /* Next to push, by the caller */
+    alignas(64) ShardOp ops[SIZE];
+};
+
+
+struct ShardedBamboo;
+
+struct Shard {
+    Bamboo *filter;
+    ShardQueue queue;
+    alignas(64) std::atomic<u64> completed{0};
+    u64 submitted = 0;      /* Only touched by the caller */
+    std::thread worker;
+};
+
+
+/* Splits the hash space by its top *log2(num_shards)* bits over 
+ * independent Bamboo filters, each owned by one worker thread. Bamboo
+ * routes on the low hash bits (bucket, segment prefix and fgpt), so the
+ * top bits make the shards disjoint subfilters of equal share.
+ *
+ * Keys are hashed once by the caller thread and queued to their shard;
+ * the workers apply them in the order queued. Operations are 
+ * asynchronous: count() writes its result and insert() takes effect by 
+ * the time flush() returns. The batch calls flush before returning. Only 
+ * one thread may call into a ShardedBamboo (the queues are SPSC). An 
+ * exception in a worker is rethrown by the next flush(). */
+struct ShardedBamboo {
+    enum { OP_INSERT, OP_REMOVE, OP_COUNT };
+
+    vector<Shard*> _shards;
+    u32 _shard_shift;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _failed;
+    std::string _error;
+
+    ShardedBamboo(int num_shards, int bucket_idx_len, int fgpt_size, 
+            int fgpt_per_bucket, int seg_idx_base, u32 seed, u32 alt_seed);
+    ~ShardedBamboo();
+    ShardedBamboo(const ShardedBamboo &) = delete;
+    ShardedBamboo &operator=(const ShardedBamboo &) = delete;
+
+    inline u64 _hash(u64 key)
+    {
+        return _shards[0]->filter->_compute_hash64(key);
+    }
+    inline Shard *_shard(u64 hash)
+    {
+        return _shards[_shard_shift < 64 ? hash >> _shard_shift : 0];
+    }
+    void _push(Shard *shard, u64 hash, u32 *result, u32 op);
+    void _run(Shard *shard);
+
+    inline void insert(u64 key) 
+    { 
+        u64 hash = _hash(key);
+        _push(_shard(hash), hash, nullptr, OP_INSERT); 
+    }
+    inline void remove(u64 key) 
+    { 
+        u64 hash = _hash(key);
+        _push(_shard(hash), hash, nullptr, OP_REMOVE); 
+    }
+    inline void count(u64 key, u32 *result) 
+    { 
+        u64 hash = _hash(key);
+        _push(_shard(hash), hash, result, OP_COUNT); 
+    }
+    int count(u64 key);
+    void insert_batch(const u64 *keys, size_t n);
+    void count_batch(const u64 *keys, size_t n, u32 *counts);
+    /* Waits until every queued operation is applied */
+    void flush();
+
+    /* After flush() */
+    u64 occupancy();
+    u64 capacity();
+};
+
+
+#endif
@@ -0,0 +1,98 @@
+#include "include/bamboo.hpp"
+#include "include/countingbamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Insert throughput of one insert() per key against insert_batch(), which
+ * sorts each batch by segment first. Once the filter outgrows the cache,
+ * single inserts miss on every segment they touch. Bamboo is run with
+ * and without reserve(); CountingBamboo, which routes through a trie,
+ * without. */
+
+double ops_per_us(std::chrono::_V2::high_resolution_clock::time_point t1,
+        u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+/* Inserts *keys* one by one if *batch* is 0, else *batch* at a time */
+template <typename Filter, typename Key>
+double bench_fill(Filter *bbf, vector<Key> &keys, size_t batch)
+{
+    size_t inserted = 0;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (!batch) {
+        for (Key key : keys)
+            inserted += bbf->insert(key);
+    } else {
+        for (size_t i = 0; i < keys.size(); i += batch)
+            inserted += bbf->insert_batch(&keys[i],
+                std::min(batch, keys.size() - i));
+    }
+    double mops = ops_per_us(t1, keys.size());
+
+    int missing = 0;
+    for (Key key : keys)
+        missing += !bbf->count(key);
+    if (missing || inserted != keys.size())
+        cout << "** " << missing << " false negatives, "
+            << keys.size() - inserted << " failed inserts **" << endl;
+    return mops;
+}
+
+
+void bench_bamboo(vector<u64> &keys, bool reserve)
+{
+    cout << "Bamboo u64 keys " << keys.size()
+        << (reserve ? " reserved" : "") << endl;
+    for (size_t batch : {0, 1 << 12, 1 << 16, 1 << 20, 1 << 24}) {
+        Bamboo *bbf = make_bamboo(8, 15, 8, 4, 0, 1, 2);
+        if (reserve)
+            bbf->reserve(keys.size());
+        double mops = bench_fill(bbf, keys, batch);
+        cout << "   batch " << std::setw(8) << batch
+            << " :: " << std::setw(6) << mops << " M/s"
+            << " :: segments " << bbf->_num_segments << endl;
+        delete bbf;
+    }
+}
+
+
+void bench_counting(vector<int> &keys)
+{
+    cout << "CountingBamboo int keys " << keys.size() << endl;
+    for (size_t batch : {0, 1 << 16, 1 << 20}) {
+        CountingBamboo *cbbf = new CountingBamboo(8, 15, 8, 4, 1, 2);
+        double mops = bench_fill(cbbf, keys, batch);
+        cout << "   batch " << std::setw(8) << batch
+            << " :: " << std::setw(6) << mops << " M/s"
+            << " :: segments " << cbbf->_num_segments << endl;
+        delete cbbf;
+    }
+}
+
+
+int main()
+{
+    cout << std::setprecision(2) << std::fixed;
+    std::mt19937_64 gen(0);
+    for (u64 num_elements : {1000000ull, 16000000ull}) {
+        vector<u64> keys(num_elements);
+        for (u64 &k : keys)
+            k = gen();
+        bench_bamboo(keys, false);
+        bench_bamboo(keys, true);
+    }
+
+    vector<int> keys(4000000);
+    for (int &k : keys)
+        k = gen();
+    bench_counting(keys);
+}
@@ -0,0 +1,114 @@
+#include "include/bamboo.hpp"
+#include "include/interleave.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Lookup throughput of the coroutine-interleaved lookups against one
+ * count() per key and count_batch(), with several numbers of lookups in
+ * flight, on a cache-sized filter and one well past the last level cache.
+ * Build with -std=c++20. */
+
+#if defined(__cpp_impl_coroutine)
+
+volatile u64 sink;
+
+double ops_per_us(std::chrono::_V2::high_resolution_clock::time_point t1,
+        u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+void bench_lookups(const char *name, Bamboo *bbf, vector<u64> &keys)
+{
+    size_t chunk = 1024;
+    vector<u32> counts(chunk);
+    u64 sum = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (u64 key : keys)
+        sum += bbf->count(key);
+    double scalar = ops_per_us(t1, keys.size());
+    u64 sum_scalar = sum;
+
+    sum = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < keys.size(); i += chunk) {
+        size_t n = std::min(chunk, keys.size() - i);
+        bbf->count_batch(&keys[i], n, counts.data());
+        for (size_t j = 0; j < n; ++j)
+            sum += counts[j];
+    }
+    double batch = ops_per_us(t1, keys.size());
+
+    cout << "   " << name
+        << " :: count() " << std::setw(6) << scalar << " M/s"
+        << " :: count_batch " << std::setw(6) << batch << " M/s" << endl;
+    cout << "          interleaved";
+    for (int group : {1, 2, 4, 8, 16, 32}) {
+        sum = 0;
+        t1 = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < keys.size(); i += chunk) {
+            size_t n = std::min(chunk, keys.size() - i);
+            count_interleaved(bbf, &keys[i], n, counts.data(), group);
+            for (size_t j = 0; j < n; ++j)
+                sum += counts[j];
+        }
+        cout << " :: " << group << " " << std::setw(6)
+            << ops_per_us(t1, keys.size());
+        if (sum != sum_scalar)
+            cout << " ** counts differ **";
+    }
+    cout << " M/s" << endl;
+    /* Plain assignment, compound ones on volatile are deprecated in C++20 */
+    sink = sum;
+}
+
+
+void bench_size(u64 num_elements)
+{
+    Bamboo *bbf = make_bamboo(8, 15, 8, 4, 0, 1, 2);
+    std::mt19937_64 gen(num_elements);
+    vector<u64> keys(num_elements);
+    for (u64 &k : keys)
+        k = gen();
+    bbf->build(keys.data(), keys.size(), 1);
+
+    size_t lookups = 8000000;
+    vector<u64> positives(lookups), negatives(lookups);
+    for (size_t i = 0; i < lookups; ++i) {
+        positives[i] = keys[gen() % num_elements];
+        negatives[i] = gen();
+    }
+
+    cout << "items " << num_elements << " segments " << bbf->_num_segments
+        << " filter " << (u64) bbf->capacity() * 2 / (1 << 20) << " MB"
+        << endl;
+    bench_lookups("hits  ", bbf, positives);
+    bench_lookups("misses", bbf, negatives);
+    delete bbf;
+}
+
+
+int main()
+{
+    cout << std::setprecision(2) << std::fixed;
+    for (u64 num_elements : {1000000ull, 64000000ull})
+        bench_size(num_elements);
+}
+
+#else
+
+int main()
+{
+    cout << "interleave-benchmark needs C++20 coroutines, build it with "
+        "-std=c++20" << endl;
+}
+
+#endif
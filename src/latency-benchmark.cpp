@@ -0,0 +1,98 @@
+#include "include/bamboo.hpp"
+#include "include/expander.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Insert latency percentiles, to see the tail that segment splits add.
+ * Compares the synchronous split of Bamboo::overflow against lazy
+ * splitting (Bamboo::_lazy_split) with a few step sizes, and both with
+ * a BackgroundExpander attached, which presplits segments off the insert
+ * path. */
+
+void print_percentiles(const char *name, vector<u32> &ns, Bamboo *bbf)
+{
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double p) { return ns[(size_t) (p * (ns.size() - 1))]; };
+    cout << std::setw(14) << name
+        << " :: p50 " << std::setw(6) << at(0.5)
+        << " :: p99 " << std::setw(6) << at(0.99)
+        << " :: p99.9 " << std::setw(6) << at(0.999)
+        << " :: p99.99 " << std::setw(7) << at(0.9999)
+        << " :: max " << std::setw(8) << ns.back() << " ns"
+        << " :: overflow() " << std::setw(6) 
+        << bbf->stats._time / std::max(bbf->stats._expand_count, 1) 
+        << " ns avg" << endl;
+}
+
+
+void bench_inserts(const char *name, int fgpt_size, int fgpt_per_bucket,
+        int num_elements, u32 chain_max, bool lazy, u32 split_step,
+        bool background)
+{
+    int bucket_idx_len = 8;
+    int seg_idx_base = 4;
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    bbf->_chain_max = chain_max;
+    bbf->_lazy_split = lazy;
+    bbf->_split_step = split_step;
+    BackgroundExpander *expander = background ?
+        new BackgroundExpander(bbf) : nullptr;
+
+    std::mt19937 gen(0);
+    vector<int> keys(num_elements);
+    for (int &k : keys)
+        k = gen();
+
+    vector<u32> ns(num_elements);
+    std::chrono::_V2::high_resolution_clock::time_point t1, t2;
+    for (int i = 0; i < num_elements; ++i) {
+        t1 = std::chrono::high_resolution_clock::now();
+        bbf->insert(keys[i]);
+        t2 = std::chrono::high_resolution_clock::now();
+        ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t2 - t1).count();
+    }
+
+    delete expander;
+
+    int missing = 0;
+    for (int k : keys)
+        missing += !bbf->count(k);
+    if (missing)
+        cout << "** " << missing << " false negatives **" << endl;
+    print_percentiles(name, ns, bbf);
+    delete bbf;
+}
+
+
+int main()
+{
+    int num_elements = 4000000;
+    /* The insert that overflows first runs a cuckoo chain of *chain_max*
+     * steps, which lazy splitting does not shorten; short chains make
+     * the split itself stand out */
+    for (u32 chain_max : {500, 50}) {
+        for (int fgpt_per_bucket : {4, 8}) {
+            cout << "fgpt_size 15 slots " << fgpt_per_bucket
+                << " chain_max " << chain_max
+                << " items " << num_elements << endl;
+            bench_inserts("eager", 15, fgpt_per_bucket, num_elements, 
+                chain_max, false, 0, false);
+            for (u32 step : {1, 8, 32}) {
+                std::string name = "lazy step " + std::to_string(step);
+                bench_inserts(name.c_str(), 15, fgpt_per_bucket, 
+                    num_elements, chain_max, true, step, false);
+            }
+            bench_inserts("eager bg", 15, fgpt_per_bucket, num_elements,
+                chain_max, false, 0, true);
+            bench_inserts("lazy 8 bg", 15, fgpt_per_bucket, num_elements,
+                chain_max, true, 8, true);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#include "include/bamboo.hpp"
+#include "include/memory.hpp"
+#include <iostream>
+#include <iomanip>
+
+using std::cout, std::endl, std::cin;
+
+/* Reports the peak resident set size of a filter filled with random keys.
+ * getPeakRSS() is process-wide, so run one configuration per invocation.
+ * Input: fgpt_size number_of_items */
+int main()
+{
+    int fgpt_size;
+    long long num_elements;
+    cout << "Enter fgpt size and number of items" << endl;
+    cin >> fgpt_size >> num_elements;
+
+    srand(0);
+    size_t base_rss = getCurrentRSS();
+
+    int bucket_idx_len = 8;
+    int fgpt_per_bucket = 8;
+    int seg_idx_base = 4;
+    Bamboo bbf(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base);
+
+    long long i;
+    try {
+        for (i = 0; i < num_elements; ++i)
+            bbf.insert(rand());
+    } catch (std::exception& e) {
+        cout << "Bucket full or something, error: " << e.what() << endl;
+    }
+
+    size_t rss = getPeakRSS() - base_rss;
+    cout << std::setprecision(4) << std::fixed;
+    cout << "fgpt_size " << fgpt_size << " items " << i
+        << " segments " << bbf._num_segments
+        << " :: peak RSS " << rss / 1024 << " KiB"
+        << " :: " << (double) rss / i << " bytes/item"
+        << " :: " << (double) rss / bbf.capacity() << " bytes/slot" << endl;
+}
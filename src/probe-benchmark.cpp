@@ -0,0 +1,138 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+
+using std::cout, std::endl;
+
+/* Microbenchmark for the bucket probe: compares the vectorized
+ * Bucket::count_fgpt against the slot-by-slot loop it replaced, and
+ * filter lookups of the runtime Bamboo against the BambooFixed engine
+ * returned by make_bamboo(). */
+
+/* The original probe loop, kept here as the baseline */
+int count_fgpt_loop(Bucket b, u32 fgpt)
+{
+    int cnt = 0;
+    for (u32 idx = 0; idx < b._len/b._step; ++idx) {
+        cnt += b.count_fgpt_at(fgpt, idx);
+    }
+    return cnt;
+}
+
+
+void bench_probe(int fgpt_size, int fgpt_per_bucket, double load)
+{
+    int num_buckets = 1 << 8;
+    int lookups = 20000000;
+    Segment seg(num_buckets, fgpt_size, fgpt_per_bucket, 0);
+
+    u32 fgpt_mask = (1 << fgpt_size) - 1;
+    for (int i = 0; i < num_buckets * fgpt_per_bucket * load; ++i) {
+        u32 fgpt = (rand() & fgpt_mask) | 1;
+        seg.bucket(rand() % num_buckets).insert_fgpt(fgpt);
+    }
+
+    /* Queries are drawn from a small fgpt alphabet so that a fair share
+     * of them hit */
+    vector<u32> queries(1 << 16);
+    for (u32 &q : queries)
+        q = ((rand() % 64) << 1) | 1;
+
+    std::chrono::_V2::high_resolution_clock::time_point t1,t2;
+    u64 ns_loop, ns_simd;
+    u64 sum_loop = 0, sum_simd = 0;
+    u32 qmask = queries.size() - 1;
+
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        sum_loop += count_fgpt_loop(seg.bucket(i & (num_buckets-1)),
+            queries[i & qmask]);
+    t2 = std::chrono::high_resolution_clock::now();
+    ns_loop = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        sum_simd += seg.bucket(i & (num_buckets-1)).count_fgpt(queries[i & qmask]);
+    t2 = std::chrono::high_resolution_clock::now();
+    ns_simd = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+
+    cout << "fgpt_size " << std::setw(2) << fgpt_size
+        << " slots " << std::setw(2) << fgpt_per_bucket
+        << " :: loop " << std::setw(8) << lookups / (ns_loop / 1e3) << " M/s"
+        << " :: simd " << std::setw(8) << lookups / (ns_simd / 1e3) << " M/s"
+        << " :: speedup " << (double) ns_loop / ns_simd << "x";
+    if (sum_loop != sum_simd)
+        cout << " ** MISMATCH " << sum_loop << " vs " << sum_simd << " **";
+    cout << endl;
+}
+
+
+volatile u64 sink;
+
+/* Lookups per second through the whole filter */
+double bench_filter(Bamboo *bbf, int num_elements, int lookups)
+{
+    srand(1);
+    for (int i = 0; i < num_elements; ++i)
+        bbf->insert(rand());
+
+    std::chrono::_V2::high_resolution_clock::time_point t1,t2;
+    u64 sum = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        sum += bbf->count(i);
+    t2 = std::chrono::high_resolution_clock::now();
+    u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    sink += sum;
+    return lookups / (ns / 1e3);
+}
+
+
+void bench_engine(int fgpt_size, int fgpt_per_bucket)
+{
+    int bucket_idx_len = 8;
+    int seg_idx_base = 4;
+    /* 7-bit fgpts allow few expansions, keep those filters small */
+    int num_elements = fgpt_size == 7 ? 50000 * fgpt_per_bucket : 1000000;
+    int lookups = 5000000;
+    Bamboo *runtime = new Bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    Bamboo *fixed = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+
+    double r = bench_filter(runtime, num_elements, lookups);
+    double f = bench_filter(fixed, num_elements, lookups);
+    cout << "fgpt_size " << std::setw(2) << fgpt_size
+        << " slots " << std::setw(2) << fgpt_per_bucket
+        << " :: runtime " << std::setw(8) << r << " M/s"
+        << " :: fixed " << std::setw(8) << f << " M/s"
+        << " :: speedup " << f / r << "x" << endl;
+    delete runtime;
+    delete fixed;
+}
+
+
+int main()
+{
+    srand(0);
+    cout << std::setprecision(4) << std::fixed;
+#if defined(__AVX2__)
+    cout << "Probe path: AVX2" << endl;
+#elif defined(__SSE2__)
+    cout << "Probe path: SSE2" << endl;
+#else
+    cout << "Probe path: scalar" << endl;
+#endif
+    for (int fgpt_size : {7, 15, 23}) {
+        for (int fgpt_per_bucket : {4, 8, 16}) {
+            bench_probe(fgpt_size, fgpt_per_bucket, 0.9);
+        }
+    }
+    cout << "Filter count(), runtime Bamboo vs make_bamboo()" << endl;
+    for (int fgpt_size : {7, 15}) {
+        for (int fgpt_per_bucket : {4, 8, 16}) {
+            bench_engine(fgpt_size, fgpt_per_bucket);
+        }
+    }
+}
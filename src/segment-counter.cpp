@@ -1,18 +1,13 @@
 #include "include/countingbamboo.hpp"
 #include <cstring>
+#include <algorithm>
+#include <cstdlib>
 #include <random>
+#include <cmath>
 
 /* bucket implementations: assuming 7, 15, 23 or 31 bit fingerprints*/
 
 
-void BucketCounter::initialize(int capacity, int fgpt_size)
-{
-    _entry_size = fgpt_size + 8;
-    _step = (_entry_size + 7) / 8;
-    _len = capacity * _step;
-    _bits = new u8[_len]();
-}
-
 /* idx is logical index */
 bool BucketCounter::_occupied_idx(int idx)
 {
@@ -225,7 +220,7 @@ u32 BucketCounter::entry_from_fgpt(u32 fgpt)
 
 
 /* Moves entries if bit in fgpt is set */
-void BucketCounter::split_bucket(BucketCounter &dst, int sep_lvl) 
+void BucketCounter::split_bucket(BucketCounter dst, int sep_lvl) 
 {
     u32 mask = (1 << (sep_lvl));
     u32 entry, fgpt;
@@ -244,13 +239,9 @@ void BucketCounter::split_bucket(BucketCounter &dst, int sep_lvl)
 vector<vector<u32>> BucketCounter::retrieve_all()
 {
     vector<vector<u32>> result;
-    u32 fgpt, cnt;
-    for (u32 idx = 0; idx < _len/_step; ++idx) {
-        fgpt = get_fgpt_at(idx);
-        cnt = count_at(idx);
-        if (fgpt)
-            result.push_back({fgpt, cnt});
-    }
+    for_each([&](u32 fgpt, u32 cnt) {
+        result.push_back({fgpt, cnt});
+    });
     return result;
 }
 
@@ -279,11 +270,39 @@ void BucketCounter::dump_bucket()
 
 
 
+/* Allocates the buckets as one zeroed, cache-line aligned slab */
+SegmentCounter::SegmentCounter(int num_buckets, int fgpt_size, 
+        int fgpt_per_bucket, int expansion__count) :
+            fgpt_size(fgpt_size),
+            num_buckets(num_buckets),
+            overflow(nullptr),
+            expansion_count(expansion__count)
+{
+    if (fgpt_size != 7 && fgpt_size != 15 && fgpt_size != 23)
+        throw std::runtime_error("Fgpt size not supported");
+    _entry_size = fgpt_size + 8;
+    _step = (_entry_size + 7) / 8;
+    _bucket_len = fgpt_per_bucket * _step;
+    size_t size = (size_t) num_buckets * _bucket_len;
+    size = (size + 63) & ~(size_t) 63;
+    _slab = (u8 *) std::aligned_alloc(64, size);
+    if (!_slab)
+        throw std::bad_alloc();
+    std::memset(_slab, 0, size);
+}
+
+
+SegmentCounter::~SegmentCounter()
+{
+    std::free(_slab);
+}
+
+
 u32 SegmentCounter::occupancy()
 {
     u32 cnt = 0;
-    for (BucketCounter &b: buckets) {
-        cnt += b.occupancy();
+    for (int i = 0; i < num_buckets; ++i) {
+        cnt += bucket(i).occupancy();
     }
     return cnt;
 }
@@ -379,7 +398,9 @@ void BitTrieCounter::dump(std::string s)
 
 /* Bamboo Implementation */
 
-/* Constructor. Seeds the hash functions and initializes the segments */
+/* Constructor. Seeds the hash functions and initializes the segments.
+ * Without explicit seeds they are drawn from rand(), so that srand() still
+ * reproduces a run; nothing after construction touches rand() */
 BambooBaseCounter::BambooBaseCounter(int bucket_idx_len, int fgpt_size, 
         int fgpt_per_bucket, int seg_idx_base) : 
             _num_segments(1 << seg_idx_base),
@@ -392,6 +413,7 @@ BambooBaseCounter::BambooBaseCounter(int bucket_idx_len, int fgpt_size,
     _bucket_mask = (1<<_bucket_idx_len)-1;
     _seed = rand();
     _alt_seed = rand();
+    _rng.seed((u64) _seed << 32 | _alt_seed);
     
     std::memset(&stats, 0, sizeof(stats));
 }
@@ -407,7 +429,8 @@ BambooBaseCounter::BambooBaseCounter(int bucket_idx_len, int fgpt_size,
             _seg_idx_base(seg_idx_base),
             _offset(0),
             _seed(seed),
-            _alt_seed(alt_seed) 
+            _alt_seed(alt_seed),
+            _rng((u64) seed << 32 | alt_seed)
 {
     _bucket_mask = (1<<_bucket_idx_len)-1;
     
@@ -427,6 +450,7 @@ BambooBaseCounter::BambooBaseCounter(int bucket_idx_len, int fgpt_size,
     _bucket_mask = (1<<_bucket_idx_len)-1;
     _seed = rand();
     _alt_seed = rand();
+    _rng.seed((u64) _seed << 32 | _alt_seed);
     
     std::memset(&stats, 0, sizeof(stats));
 }
@@ -442,7 +466,8 @@ BambooBaseCounter::BambooBaseCounter(int bucket_idx_len, int fgpt_size,
             _seg_idx_base(seg_idx_base),
             _offset(offset),
             _seed(seed),
-            _alt_seed(alt_seed) 
+            _alt_seed(alt_seed),
+            _rng((u64) seed << 32 | alt_seed)
 {
     _bucket_mask = (1<<_bucket_idx_len)-1;
     
@@ -462,11 +487,17 @@ int BambooBaseCounter::count(int elt)
     SegmentCounter *segment;
     if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
         return false;
+    return _count_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+int BambooBaseCounter::_count_extracted(u32 fgpt, SegmentCounter *segment, 
+        u32 bidx1, u32 bidx2)
+{
     int count = 0;
     while (segment) 
     {
-        count += segment->buckets[bidx1].count_fgpt(fgpt) 
-            + segment->buckets[bidx2].count_fgpt(fgpt);
+        count += segment->bucket(bidx1).count_fgpt(fgpt) 
+            + segment->bucket(bidx2).count_fgpt(fgpt);
         segment = segment->overflow;
     }
     return count;
@@ -489,8 +520,8 @@ ret:
 bool BambooBaseCounter::insert(int elt, u32 fgpt, u32 seg_idx, 
         SegmentCounter *segment, u32 bidx1, u32 bidx2)
 {
-    bool r = !segment->buckets[bidx1].insert_fgpt(fgpt) 
-            || !segment->buckets[bidx2].insert_fgpt(fgpt)
+    bool r = !segment->bucket(bidx1).insert_fgpt(fgpt) 
+            || !segment->bucket(bidx2).insert_fgpt(fgpt)
             || _cuckoo(segment, seg_idx, bidx1, bidx2, fgpt, 1, 1);
     return r;
 }
@@ -503,10 +534,16 @@ bool BambooBaseCounter::remove(int elt)
     SegmentCounter *segment;
     if (!_extract(elt, fgpt, seg_idx, segment, bidx1, bidx2))
         return false;
+    return _remove_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+bool BambooBaseCounter::_remove_extracted(u32 fgpt, SegmentCounter *segment, 
+        u32 bidx1, u32 bidx2)
+{
     while (segment)
     {
-        if(segment->buckets[bidx1].remove_fgpt(fgpt)
-            || segment->buckets[bidx2].remove_fgpt(fgpt))
+        if(segment->bucket(bidx1).remove_fgpt(fgpt)
+            || segment->bucket(bidx2).remove_fgpt(fgpt))
             return true;
         segment = segment->overflow;
     }
@@ -514,54 +551,89 @@ bool BambooBaseCounter::remove(int elt)
 }
 
 
-/* Main cuckoo-insertion logic */
+/* Hashed-key API */
+
+int BambooBaseCounter::count_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    SegmentCounter *segment;
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    return _count_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+bool BambooBaseCounter::insert_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    SegmentCounter *segment;
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    return insert((int) hash, fgpt, seg_idx, segment, bidx1, bidx2);
+}
+
+bool BambooBaseCounter::remove_hash(u64 hash)
+{
+    u32 fgpt;
+    u32 bidx1, bidx2, seg_idx;
+    SegmentCounter *segment;
+    _extract_hash(hash, fgpt, seg_idx, segment, bidx1, bidx2);
+    return _remove_extracted(fgpt, segment, bidx1, bidx2);
+}
+
+
+/* Main cuckoo-insertion logic. A random walk, run as a loop so that long
+ * chains need no stack */
 bool BambooBaseCounter::_cuckoo(SegmentCounter *segment, u32 seg_idx, 
         u32 bi_main, u32 bi_alt, u32 fgpt, u32 fgpt_cnt, u32 chain_len)
 {
-    ++stats._counter0;
-    if (chain_len == _chain_max) {
-        // cout << "Chain max " << _chain_max << " reached, attempt to expand segment" << endl;
-        ++stats._counter1;
-        return overflow(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
-    }
-
     int evict_bidx, evict_idx;
-    u32 evict_fgpt, evict_fgpt_cnt;
-    int i = 0;
-    evict_bidx = bi_alt;
-    evict_idx = rand() % _fgpt_per_bucket;
-    if (!segment->buckets[evict_bidx].count_fgpt_at(fgpt, evict_idx)) {
-        evict_fgpt = segment->buckets[evict_bidx]
-            .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
-        goto evict;
-    }
+    u32 evict_fgpt, evict_fgpt_cnt, alt_bidx;
+    for (;; ++chain_len) {
+        ++stats._counter0;
+        if (chain_len == _chain_max) {
+            // cout << "Chain max " << _chain_max << " reached, attempt to expand segment" << endl;
+            ++stats._counter1;
+            return overflow(segment, seg_idx, bi_main, bi_alt, fgpt, fgpt_cnt);
+        }
+
+        int i = 0;
+        evict_bidx = bi_alt;
+        evict_idx = _rng.below(_fgpt_per_bucket);
+        if (!segment->bucket(evict_bidx).count_fgpt_at(fgpt, evict_idx)) {
+            evict_fgpt = segment->bucket(evict_bidx)
+                .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
+            goto evict;
+        }
 
-    for (int bidx : {bi_alt, bi_main}) {
-        for (evict_idx = 0; evict_idx < _fgpt_per_bucket; ++evict_idx) {
-            if (!segment->buckets[bidx].count_fgpt_at(fgpt, evict_idx)) {
-                evict_fgpt = segment->buckets[bidx]
-                    .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
-                evict_bidx = bidx;
-                goto evict;
+        for (int bidx : {bi_alt, bi_main}) {
+            for (evict_idx = 0; evict_idx < _fgpt_per_bucket; ++evict_idx) {
+                if (!segment->bucket(bidx).count_fgpt_at(fgpt, evict_idx)) {
+                    evict_fgpt = segment->bucket(bidx)
+                        .evict_fgpt_at(evict_idx, evict_fgpt_cnt);
+                    evict_bidx = bidx;
+                    goto evict;
+                }
+                i += 1;
             }
-            i += 1;
         }
-    }
-    cout << "This item is represented " << i << " times in the filter."
-        << " Both buckets filled by the same fingerprint - cuckoo not possible" << endl;
-    cout << "Params: " << segment << " " << seg_idx << " " << bi_main << " " << bi_alt 
-        << " " << bitset<32>(fgpt) << " " << chain_len << endl;
-    throw std::runtime_error("Bucket capacity reached");
+        cout << "This item is represented " << i << " times in the filter."
+            << " Both buckets filled by the same fingerprint - cuckoo not possible" << endl;
+        cout << "Params: " << segment << " " << seg_idx << " " << bi_main << " " << bi_alt 
+            << " " << bitset<32>(fgpt) << " " << chain_len << endl;
+        throw std::runtime_error("Bucket capacity reached");
 
 evict:
-    segment->buckets[evict_bidx].insert_fgpt_count_at(evict_idx, fgpt, fgpt_cnt);
-    u32 alt_bidx = _alt_bucket(evict_fgpt, evict_bidx);
-    
-    if (!segment->buckets[alt_bidx].insert_fgpt_count(evict_fgpt, evict_fgpt_cnt)) {
-        return true;
+        segment->bucket(evict_bidx).insert_fgpt_count_at(evict_idx, fgpt, fgpt_cnt);
+        alt_bidx = _alt_bucket(evict_fgpt, evict_bidx);
+        
+        if (!segment->bucket(alt_bidx).insert_fgpt_count(evict_fgpt, evict_fgpt_cnt)) {
+            return true;
+        }
+        bi_main = evict_bidx;
+        bi_alt = alt_bidx;
+        fgpt = evict_fgpt;
+        fgpt_cnt = evict_fgpt_cnt;
     }
-    return _cuckoo(segment, seg_idx, evict_bidx, alt_bidx, evict_fgpt, 
-            evict_fgpt_cnt, chain_len+1);
 }
 
 
@@ -597,20 +669,19 @@ CountingBamboo::~CountingBamboo()
 
 
 
-bool CountingBamboo::overflow(SegmentCounter *segment, u32 seg_idx, u32 bidx1, u32 bidx2, 
-        u32 fgpt, u32 fgpt_cnt)
+SegmentCounter *CountingBamboo::split(SegmentCounter *segment, u32 seg_idx)
 {
-    ++stats._expand_count;
-    int expansion_count = ++segment->expansion_count;
+    int expansion_count = segment->expansion_count + 1;
     if (expansion_count >= _fgpt_size) 
         throw std::runtime_error("Bamboo max expansion capacity breached");
+    segment->expansion_count = expansion_count;
     
     u8 ilen = expansion_count + _seg_idx_base;
     u32 new_idx = seg_idx | (1 << (ilen - 1));
 
     // cout << "Expanding segment " << bitset<16>(seg_idx) << " into segment " << bitset<16>(new_idx) 
     //     << " : Expansion count = " << expansion_count  
-    //     << " ilen = " << (u32) ilen << " to insert " << bitset<16>(fgpt) << endl; 
+    //     << " ilen = " << (u32) ilen << endl; 
  
     SegmentCounter *new_segment = new SegmentCounter(1 << _bucket_idx_len, _fgpt_size, 
         _fgpt_per_bucket, expansion_count);
@@ -619,17 +690,43 @@ bool CountingBamboo::overflow(SegmentCounter *segment, u32 seg_idx, u32 bidx1, u
     _trie_head->clear(seg_idx, ilen-1);
     
     for (int i = 0; i < (1 << _bucket_idx_len); i++) {
-        segment->buckets[i]
-            .split_bucket(new_segment->buckets[i], expansion_count-1);
+        segment->bucket(i)
+            .split_bucket(new_segment->bucket(i), expansion_count-1);
     }
+    ++_num_segments;
+    return new_segment;
+}
+
+
+void CountingBamboo::reserve(u64 expected_items, double target_load)
+{
+    u32 depth = _reserve_depth(expected_items, target_load);
+    u32 seg_idx;
+    for (u32 i = 0; i < (1u << depth); ++i) {
+        SegmentCounter *segment = _get_segment(i, seg_idx);
+        while (_seg_idx_base + segment->expansion_count < (int) depth) {
+            split(segment, seg_idx);
+            segment = _get_segment(i, seg_idx);
+        }
+    }
+}
+
+
+bool CountingBamboo::overflow(SegmentCounter *segment, u32 seg_idx, u32 bidx1, u32 bidx2, 
+        u32 fgpt, u32 fgpt_cnt)
+{
+    ++stats._expand_count;
+    SegmentCounter *new_segment = split(segment, seg_idx);
+    int expansion_count = segment->expansion_count;
+    u32 new_idx = seg_idx | (1 << (expansion_count + _seg_idx_base - 1));
+
     if (1<<(expansion_count - 1) & fgpt) {
         segment = new_segment;
         seg_idx = new_idx;
     }
-    ++_num_segments;
 
-    bool r = !segment->buckets[bidx1].insert_fgpt_count(fgpt, fgpt_cnt) 
-        || !segment->buckets[bidx2].insert_fgpt_count(fgpt, fgpt_cnt)
+    bool r = !segment->bucket(bidx1).insert_fgpt_count(fgpt, fgpt_cnt) 
+        || !segment->bucket(bidx2).insert_fgpt_count(fgpt, fgpt_cnt)
         || _cuckoo(segment, seg_idx, bidx1, bidx2, fgpt, fgpt_cnt, 1);
 
 
@@ -637,20 +734,103 @@ bool CountingBamboo::overflow(SegmentCounter *segment, u32 seg_idx, u32 bidx1, u
 }
 
 
+/* Stable LSD radix sort of *keys* by the low *bits* bits of their hash
+ * fragment, a byte per pass. *tmp* is scratch space */
+static void _sort_by_prefix(vector<RoutedKeyCounter> &keys, 
+        vector<RoutedKeyCounter> &tmp, u32 bits)
+{
+    tmp.resize(keys.size());
+    for (u32 shift = 0; shift < bits; shift += 8) {
+        u32 mask = (1u << std::min<u32>(bits - shift, 8)) - 1;
+        size_t offsets[256] = {0};
+        for (RoutedKeyCounter &k : keys)
+            ++offsets[k.hashfrag >> shift & mask];
+        size_t sum = 0;
+        for (u32 d = 0; d <= mask; ++d) {
+            size_t cnt = offsets[d];
+            offsets[d] = sum;
+            sum += cnt;
+        }
+        for (RoutedKeyCounter &k : keys)
+            tmp[offsets[k.hashfrag >> shift & mask]++] = k;
+        keys.swap(tmp);
+    }
+}
+
+
+size_t CountingBamboo::insert_batch(const int *keys, size_t n)
+{
+    return _insert_batch(keys, n);
+}
+
+size_t CountingBamboo::insert_batch(const u64 *keys, size_t n)
+{
+    return _insert_batch(keys, n);
+}
+
+/* Segments have different depths in the trie. Sorting by the depth of an
+ * even split of *_num_segments*, or of *n* keys if that is deeper, keeps
+ * each one's keys together or nearly so */
+template <typename Key>
+size_t CountingBamboo::_insert_batch(const Key *keys, size_t n)
+{
+    vector<RoutedKeyCounter> routed(n), tmp;
+    for (size_t i = 0; i < n; ++i)
+        _route(keys[i], routed[i].fgpt, routed[i].hashfrag, routed[i].bidx1);
+    u32 bits = _seg_idx_base;
+    u64 slots = (u64) _fgpt_per_bucket << _bucket_idx_len;
+    while (bits < (u32) (_seg_idx_base + _fgpt_size - 1) 
+            && ((1 << bits) < _num_segments || (slots << bits) < n))
+        ++bits;
+    _sort_by_prefix(routed, tmp, bits);
+    vector<RoutedKeyCounter>().swap(tmp);
+
+    size_t inserted = 0;
+    u32 seg_idx;
+    for (RoutedKeyCounter &k : routed) {
+        SegmentCounter *segment = _get_segment(k.hashfrag, seg_idx);
+        inserted += insert((int) k.hashfrag, k.fgpt, seg_idx, segment,
+            k.bidx1, _alt_bucket(k.fgpt, k.bidx1));
+    }
+    return inserted;
+}
+
+
+u32 BambooBaseCounter::_reserve_depth(u64 expected_items, double target_load)
+{
+    double per_segment = target_load * (1 << _bucket_idx_len) 
+        * _fgpt_per_bucket;
+    u64 segments = (u64) std::ceil(expected_items / per_segment);
+    u32 depth = _seg_idx_base;
+    while ((1ull << depth) < segments)
+        ++depth;
+    if (depth - _seg_idx_base >= (u32) _fgpt_size)
+        throw std::runtime_error("Bamboo reserve exceeds max expansion capacity");
+    return depth;
+}
+
+
 /* Writes the fingerprints and bucket indices from the elt into the
  * respective variables passed into the function. */
 bool BambooBaseCounter::_extract(int elt, u32 &fgpt, u32 &seg_idx, 
         SegmentCounter *&segment, u32 &bidx1, u32 &bidx2)
 {
-    u32 hash = _compute_hash(elt);
-    fgpt = (hash >> (_bucket_idx_len + _seg_idx_base)) & ((1<<_fgpt_size) - 1);
-    
-    /* Rehash if the fingerprint is all zeros */
-    if (!fgpt) {
-        return _extract(hash, fgpt, seg_idx, segment, bidx1, bidx2);
-    }
-    segment = _get_segment(hash >> _bucket_idx_len, seg_idx);
-    bidx1 = hash & _bucket_mask;
+    u32 hashfrag;
+    _route(elt, fgpt, hashfrag, bidx1);
+    segment = _get_segment(hashfrag, seg_idx);
+    bidx2 = _alt_bucket(fgpt, bidx1);
+    return true;
+}
+
+
+/* Same as _extract(), from a 64-bit hash. An all-zero fgpt is replaced by
+ * its top bit instead of rehashing, see BambooBase::_extract_hash() */
+bool BambooBaseCounter::_extract_hash(u64 hash, u32 &fgpt, u32 &seg_idx, 
+        SegmentCounter *&segment, u32 &bidx1, u32 &bidx2)
+{
+    u32 hashfrag;
+    _route_hash(hash, fgpt, hashfrag, bidx1);
+    segment = _get_segment(hashfrag, seg_idx);
     bidx2 = _alt_bucket(fgpt, bidx1);
     return true;
 }
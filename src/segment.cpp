@@ -1,15 +1,12 @@
 #include "include/bamboo.hpp"
+#include "include/probe.hpp"
+#include "include/semisort.hpp"
+#include <cstdlib>
+#include <cstring>
 
 /* bucket implementations: assuming 7, 15, 23 or 31 bit fingerprints*/
 
 
-void Bucket::initialize(int capacity, int fgpt_size)
-{
-    _step = (fgpt_size + 7) / 8;
-    _len = capacity * _step;
-    _bits = new u8[_len]();
-}
-
 /* idx is logical index */
 bool Bucket::_occupied_idx(int idx)
 {
@@ -21,15 +18,38 @@ bool Bucket::_occupied_idx(int idx)
 }
 
 
-/* returns index of first bit of fgpt*/
+/* returns index of first vacant slot, -1 if the bucket is full */
 int Bucket::_vacant_idx()
 {   
-    for (u32 idx = 0; idx <  _len/_step; ++idx) {
-        if (!_occupied_idx(idx) ) {
-            return idx;
-        }
+    u64 vacant = ~occupied_mask() & _slot_mask();
+    return vacant ? __builtin_ctzll(vacant) : -1;
+}
+
+
+/* Bit i of the result is set iff (entry_i & *mask*) == *key*. The 7 and 
+ * 15-bit layouts compare all slots at once, wider entries go slot by slot */
+u64 Bucket::_probe(u32 key, u32 mask)
+{
+    int n = _len/_step;
+    switch (_step) {
+    case 1:
+        return probe8(_bits, n, key, mask);
+    case 2:
+        return probe16(_bits, n, key, mask);
     }
-    return -1;
+    u64 r = 0;
+    for (int idx = 0; idx < n; ++idx) {
+        r |= (u64) ((get_entry_at(idx) & mask) == key) << idx;
+    }
+    return r;
+}
+
+
+/* Bit i of the result is set iff slot i is in use. Stands in for a
+ * tracked occupancy bitmask, at the cost of one compare per bucket */
+u64 Bucket::occupied_mask()
+{
+    return ~_probe(0, _entry_mask()) & _slot_mask();
 }
 
 u32 inline Bucket::count_at(int idx) 
@@ -61,24 +81,37 @@ u32 Bucket::count_fgpt_at(u32 fgpt, int idx)
 }
 
 
+/* Bit i of the result is set iff slot i holds *fgpt* */
+u64 Bucket::match_fgpt(u32 fgpt)
+{
+    if (!fgpt)
+        return 0;
+    return _probe(entry_from_fgpt(fgpt), _entry_mask() & ~1);
+}
+
+
+/* Bit i of the result is set iff the flag bit of slot i is set, ie. the
+ * slot stores two copies of its fingerprint */
+u64 Bucket::flag_mask()
+{
+    return _probe(1, 1);
+}
+
+
 int Bucket::count_fgpt(u32 fgpt)
 {
-    int cnt = 0;
-    for (u32 idx = 0; idx < _len/_step; ++idx) {
-        cnt += count_fgpt_at(fgpt, idx);
-    } 
-    return cnt;
+    u64 match = match_fgpt(fgpt);
+    if (!match)
+        return 0;
+    return __builtin_popcountll(match) 
+        + __builtin_popcountll(match & flag_mask());
 }
 
 /* returns logical index of fgpt*/
 int Bucket::find_fgpt(u32 fgpt)
 {
-    for (u32 idx = 0; idx < _len/_step; ++idx) {
-        if (count_fgpt_at(fgpt, idx)) {
-            return idx;
-        }
-    }
-    return -1;
+    u64 match = match_fgpt(fgpt);
+    return match ? __builtin_ctzll(match) : -1;
 }
 
 /* Should be called on an empty index */
@@ -114,16 +147,15 @@ u32 Bucket::insert_fgpt(u32 fgpt)
 u32 Bucket::insert_fgpt_count(u32 fgpt, u32 &count)
 {
     /* Try to update the count of existing fgpt*/
-    u32 num;
     int idx;
-    for (idx = 0; idx < _len/_step; ++idx) {
-        num = count_fgpt_at(fgpt, idx);
-        if (num > 0 && num < 2) {
-            increment_at(idx);
-            --count;
-            if (count == 0)
-                return count;
-        }
+    u64 single = match_fgpt(fgpt);
+    if (single)
+        single &= ~flag_mask();
+    for (; single; single &= single - 1) {
+        increment_at(__builtin_ctzll(single));
+        --count;
+        if (count == 0)
+            return count;
     }
     /* Else find empty slot*/
     while ((idx = _vacant_idx()) > -1 && count) {
@@ -216,17 +248,17 @@ u32 Bucket::entry_from_fgpt(u32 fgpt)
 
 
 /* Moves entries if bit in fgpt is set */
-void Bucket::split_bucket(Bucket &dst, int sep_lvl) 
+void Bucket::split_bucket(Bucket dst, int sep_lvl) 
 {
     u32 mask = (1 << (sep_lvl+1));
     u32 entry;
+    int idx;
 
-    for (u32 idx = 0; idx < _len/_step; ++idx) {
+    for (u64 move = _probe(mask, mask); move; move &= move - 1) {
+        idx = __builtin_ctzll(move);
         entry = get_entry_at(idx);
-        if((mask & entry) == mask) {
-            reset_entry_at(idx);
-            dst.insert_entry(entry);
-        }
+        reset_entry_at(idx);
+        dst.insert_entry(entry);
     }
 }
 
@@ -234,24 +266,16 @@ void Bucket::split_bucket(Bucket &dst, int sep_lvl)
 vector<vector<u32>> Bucket::retrieve_all()
 {
     vector<vector<u32>> result;
-    u32 fgpt, cnt;
-    for (u32 idx = 0; idx < _len/_step; ++idx) {
-        fgpt = get_fgpt_at(idx);
-        cnt = count_at(idx);
-        if (fgpt)
-            result.push_back({fgpt, cnt});
-    }
+    for_each([&](u32 fgpt, u32 cnt) {
+        result.push_back({fgpt, cnt});
+    });
     return result;
 }
 
 
 u32 Bucket::occupancy()
 {
-    u32 cnt = 0;
-    for (u32 idx = 0; idx <  _len/_step; ++idx) {
-        cnt += _occupied_idx(idx);
-    }
-    return cnt;
+    return __builtin_popcountll(occupied_mask());
 }
 
 
@@ -269,11 +293,171 @@ void Bucket::dump_bucket()
 
 
 
+/* Segment implementation */
+
+/* Allocates the buckets as one zeroed, cache-line aligned slab */
+Segment::Segment(int num_buckets, int fgpt_size, int fgpt_per_bucket, 
+        int expansion__count) :
+            _packed(nullptr),
+            fgpt_size(fgpt_size),
+            num_buckets(num_buckets),
+            overflow(nullptr),
+            expansion_count(expansion__count),
+            _split(nullptr),
+            _load(0),
+            _stash_len(0)
+{
+    if (fgpt_size != 7 && fgpt_size != 15 && fgpt_size != 23)
+        throw std::runtime_error("Fgpt size not supported");
+    if (fgpt_per_bucket > 64)
+        throw std::runtime_error("At most 64 fgpts per bucket supported");
+    _step = (fgpt_size + 7) / 8;
+    _bucket_len = fgpt_per_bucket * _step;
+    _allocate_slab();
+}
+
+
+Segment::~Segment()
+{
+    std::free(_slab);
+    std::free(_packed);
+}
+
+
+void Segment::_allocate_slab()
+{
+    size_t size = (size_t) num_buckets * _bucket_len;
+    size = (size + 63) & ~(size_t) 63;
+    _slab = (u8 *) std::aligned_alloc(64, size);
+    if (!_slab)
+        throw std::bad_alloc();
+    std::memset(_slab, 0, size);
+}
+
+
+/* Lazy splits */
+
+void Segment::_migrate(u32 bidx)
+{
+    SplitState *split = _split;
+    split->src->bucket(bidx).split_bucket(split->dst->bucket(bidx), 
+        split->sep_lvl);
+    split->migrated[bidx >> 6] |= (u64) 1 << (bidx & 63);
+    if (++split->num_migrated == (u32) num_buckets) {
+        /* Detach from both halves; the owner frees the state */
+        split->src->_split = nullptr;
+        split->dst->_split = nullptr;
+        split->src = nullptr;
+        split->dst = nullptr;
+    }
+}
+
+
+void Segment::finish_split()
+{
+    for (u32 i = 0; _split; ++i)
+        settle(i);
+}
+
+
+int Segment::count_unmigrated(u32 bidx, u32 fgpt)
+{
+    if (this != _split->dst || _split->is_migrated(bidx))
+        return 0;
+    return _split->src->bucket(bidx).count_fgpt(fgpt);
+}
+
+
+/* Re-encodes the slab with semi-sorted buckets and releases it. Returns
+ * false if the layout is not supported: 4 slots of 1 or 2 bytes */
+bool Segment::pack()
+{
+    if (_packed)
+        return true;
+    if (_bucket_len / _step != SemiSortedBucket::SLOTS || _step > 2)
+        return false;
+    finish_split();
+
+    int entry_bits = 8 * _step;
+    u64 bucket_bits = SemiSortedBucket::bucket_bits(entry_bits);
+    size_t size = (num_buckets * bucket_bits + 7) / 8 + SemiSortedBucket::PAD;
+    _packed = (u8 *) std::calloc(size, 1);
+    if (!_packed)
+        throw std::bad_alloc();
+
+    u32 entries[SemiSortedBucket::SLOTS];
+    for (int i = 0; i < num_buckets; ++i) {
+        Bucket b = bucket(i);
+        for (int j = 0; j < SemiSortedBucket::SLOTS; ++j)
+            entries[j] = b.get_entry_at(j);
+        SemiSortedBucket::encode(entries, entry_bits, _packed, i * bucket_bits);
+    }
+    std::free(_slab);
+    _slab = nullptr;
+    return true;
+}
+
+
+void Segment::unpack()
+{
+    if (!_packed)
+        return;
+    _allocate_slab();
+
+    int entry_bits = 8 * _step;
+    u64 bucket_bits = SemiSortedBucket::bucket_bits(entry_bits);
+    u32 entries[SemiSortedBucket::SLOTS];
+    for (int i = 0; i < num_buckets; ++i) {
+        Bucket b = bucket(i);
+        SemiSortedBucket::decode(_packed, i * bucket_bits, entry_bits, entries);
+        for (int j = 0; j < SemiSortedBucket::SLOTS; ++j) {
+            if (entries[j])
+                b.insert_entry(entries[j]);
+        }
+    }
+    std::free(_packed);
+    _packed = nullptr;
+}
+
+
+int Segment::count_packed(u32 bidx, u32 fgpt)
+{
+    int entry_bits = 8 * _step;
+    return SemiSortedBucket::count_fgpt(_packed, 
+        bidx * SemiSortedBucket::bucket_bits(entry_bits), entry_bits, fgpt);
+}
+
+
+/* Removes a copy of *fgpt* from the stash, see count_stash() */
+bool Segment::remove_stash(u32 bidx1, u32 bidx2, u32 fgpt)
+{
+    for (int i = 0; i < _stash_len; ++i) {
+        StashEntry &e = _stash[i];
+        if (e.entry >> 1 != fgpt || (e.bidx != bidx1 && e.bidx != bidx2))
+            continue;
+        if (e.entry & 1)
+            e.entry &= ~1u;
+        else
+            e = _stash[--_stash_len];
+        return true;
+    }
+    return false;
+}
+
+
 u32 Segment::occupancy()
 {
-    u32 cnt = 0;
-    for (Bucket &b: buckets) {
-        cnt += b.occupancy();
+    u32 cnt = _stash_len;
+    if (_packed) {
+        int entry_bits = 8 * _step;
+        u64 bucket_bits = SemiSortedBucket::bucket_bits(entry_bits);
+        for (int i = 0; i < num_buckets; ++i)
+            cnt += SemiSortedBucket::occupancy(_packed, i * bucket_bits, 
+                entry_bits);
+        return cnt;
+    }
+    for (int i = 0; i < num_buckets; ++i) {
+        cnt += bucket(i).occupancy();
     }
     return cnt;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "include/bamboo.hpp"
+#include "include/semisort.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+
+using std::cout, std::endl;
+
+/* Compares the plain bucket layout against the semi-sorted encoding of
+ * Bamboo::pack(): storage bits per stored entry and lookup throughput. */
+
+volatile u64 sink;
+
+double lookups_per_us(Bamboo &bbf, int lookups, vector<int> &counts)
+{
+    std::chrono::_V2::high_resolution_clock::time_point t1,t2;
+    u64 sum = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        int c = bbf.count(i);
+        sum += c;
+        if (counts.size() < (size_t) lookups)
+            counts.push_back(c);
+        else if (counts[i] != c)
+            cout << "** count mismatch at " << i << " **" << endl;
+    }
+    t2 = std::chrono::high_resolution_clock::now();
+    sink += sum;
+    u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    return lookups / (ns / 1e3);
+}
+
+
+void bench_semisort(int fgpt_size, int num_elements)
+{
+    int bucket_idx_len = 8;
+    int fgpt_per_bucket = 4;
+    int seg_idx_base = 4;
+    int lookups = 2 * num_elements;
+    Bamboo bbf(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base);
+
+    /* Even keys are inserted, odd ones are negative lookups */
+    for (int i = 0; i < num_elements; ++i)
+        bbf.insert(2*i);
+
+    u32 items = bbf.occupancy();
+    u64 buckets = (u64) bbf._num_segments << bucket_idx_len;
+    int entry_bits = 8 * ((fgpt_size + 7) / 8);
+    u64 plain_bits = buckets * fgpt_per_bucket * entry_bits;
+    u64 packed_bits = buckets * SemiSortedBucket::bucket_bits(entry_bits);
+
+    vector<int> counts;
+    double plain = lookups_per_us(bbf, lookups, counts);
+    if (!bbf.pack()) {
+        cout << "Layout cannot be packed" << endl;
+        return;
+    }
+    double packed = lookups_per_us(bbf, lookups, counts);
+    if (bbf.occupancy() != items)
+        cout << "** occupancy mismatch after pack **" << endl;
+
+    cout << "fgpt_size " << std::setw(2) << fgpt_size
+        << " entries " << items
+        << " load " << (double) items / bbf.capacity() << endl;
+    cout << "   plain  :: " << std::setw(7) << (double) plain_bits / items
+        << " bits/entry :: " << std::setw(7) << plain << " M lookups/s" << endl;
+    cout << "   packed :: " << std::setw(7) << (double) packed_bits / items
+        << " bits/entry :: " << std::setw(7) << packed << " M lookups/s" << endl;
+}
+
+
+int main()
+{
+    srand(0);
+    cout << std::setprecision(4) << std::fixed;
+    bench_semisort(7, 600000);
+    bench_semisort(15, 2000000);
+}
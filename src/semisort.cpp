@@ -0,0 +1,111 @@
+#include "include/semisort.hpp"
+#include <algorithm>
+#include <cstring>
+
+/* Semi-sorted bucket implementation */
+
+
+/* *decode* maps an index to its sorted nibble quadruple, packed lowest
+ * nibble first; *encode* is the inverse. Only *decode* is needed for
+ * lookups, and it fits in 8KB. */
+struct SemiSortTables {
+    u16 decode[SemiSortedBucket::NUM_PREFIXES];
+    u16 encode[1 << 16];
+
+    SemiSortTables()
+    {
+        int idx = 0;
+        for (int a = 0; a < 16; ++a)
+            for (int b = a; b < 16; ++b)
+                for (int c = b; c < 16; ++c)
+                    for (int d = c; d < 16; ++d) {
+                        u16 q = a | (b << 4) | (c << 8) | (d << 12);
+                        decode[idx] = q;
+                        encode[q] = idx;
+                        ++idx;
+                    }
+    }
+};
+
+static const SemiSortTables tables;
+
+
+/* Reads *len* <= 64 bits at *bit_offset* */
+static inline u64 read_bits(const u8 *packed, u64 bit_offset, int len)
+{
+    unsigned __int128 w;
+    std::memcpy(&w, packed + (bit_offset >> 3), sizeof(w));
+    w >>= bit_offset & 7;
+    return (u64) w & (len == 64 ? ~(u64) 0 : ((u64) 1 << len) - 1);
+}
+
+
+static inline void write_bits(u8 *packed, u64 bit_offset, int len, u64 val)
+{
+    unsigned __int128 w, mask;
+    std::memcpy(&w, packed + (bit_offset >> 3), sizeof(w));
+    mask = (unsigned __int128) (len == 64 ? ~(u64) 0 : ((u64) 1 << len) - 1)
+        << (bit_offset & 7);
+    w = (w & ~mask) | ((unsigned __int128) val << (bit_offset & 7));
+    std::memcpy(packed + (bit_offset >> 3), &w, sizeof(w));
+}
+
+
+void SemiSortedBucket::encode(const u32 *entries, int entry_bits,
+        u8 *packed, u64 bit_offset)
+{
+    int low_bits = entry_bits - 4;
+    u32 sorted[SLOTS];
+    std::copy(entries, entries + SLOTS, sorted);
+    std::sort(sorted, sorted + SLOTS);
+
+    u32 q = 0;
+    u64 lows = 0;
+    for (int i = 0; i < SLOTS; ++i) {
+        q |= (sorted[i] >> low_bits) << (4*i);
+        lows |= (u64) (sorted[i] & ((1 << low_bits) - 1)) << (low_bits*i);
+    }
+    write_bits(packed, bit_offset, bucket_bits(entry_bits),
+        tables.encode[q] | (lows << 12));
+}
+
+
+void SemiSortedBucket::decode(const u8 *packed, u64 bit_offset,
+        int entry_bits, u32 *entries)
+{
+    int low_bits = entry_bits - 4;
+    u64 w = read_bits(packed, bit_offset, bucket_bits(entry_bits));
+    u32 q = tables.decode[w & 0xFFF];
+    w >>= 12;
+    for (int i = 0; i < SLOTS; ++i) {
+        entries[i] = (((q >> (4*i)) & 0xF) << low_bits)
+            | (w & ((1 << low_bits) - 1));
+        w >>= low_bits;
+    }
+}
+
+
+int SemiSortedBucket::count_fgpt(const u8 *packed, u64 bit_offset,
+        int entry_bits, u32 fgpt)
+{
+    u32 entries[SLOTS];
+    decode(packed, bit_offset, entry_bits, entries);
+    int cnt = 0;
+    for (int i = 0; i < SLOTS; ++i) {
+        if (fgpt && (entries[i] >> 1) == fgpt)
+            cnt += (entries[i] & 1) + 1;
+    }
+    return cnt;
+}
+
+
+int SemiSortedBucket::occupancy(const u8 *packed, u64 bit_offset,
+        int entry_bits)
+{
+    u32 entries[SLOTS];
+    decode(packed, bit_offset, entry_bits, entries);
+    int cnt = 0;
+    for (int i = 0; i < SLOTS; ++i)
+        cnt += entries[i] != 0;
+    return cnt;
+}
@@ -0,0 +1,95 @@
+#include "include/bamboo.hpp"
+#include "include/sharded.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using std::cout, std::endl;
+
+/* Ingest and lookup throughput of ShardedBamboo by number of shards (one
+ * worker thread each), against a single Bamboo on the caller thread. 
+ * Keys go through insert_batch() and count_batch() in chunks, the way a
+ * loader would feed it. */
+
+volatile u64 sink;
+
+double mops(std::chrono::_V2::high_resolution_clock::time_point t1, u64 ops)
+{
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return ops / (std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e3);
+}
+
+
+int main()
+{
+    u64 num_keys = 8000000;
+    size_t chunk = 1 << 16;
+    int bucket_idx_len = 8, fgpt_size = 15, fgpt_per_bucket = 8;
+    int seg_idx_base = 4;
+    std::mt19937_64 gen(0);
+    vector<u64> keys(num_keys), negatives(num_keys);
+    for (u64 &k : keys)
+        k = gen();
+    for (u64 &k : negatives)
+        k = gen();
+    vector<u32> counts(chunk);
+
+    cout << std::setprecision(2) << std::fixed;
+    cout << "hardware threads " << std::thread::hardware_concurrency()
+        << " :: keys " << num_keys << " :: chunk " << chunk << endl;
+
+    Bamboo *bbf = make_bamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket,
+        seg_idx_base, 0, 1, 2);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (u64 k : keys)
+        bbf->insert(k);
+    double ins = mops(t1, num_keys);
+    u64 hits = 0;
+    t1 = std::chrono::high_resolution_clock::now();
+    for (u64 k : negatives)
+        hits += bbf->count(k);
+    double look = mops(t1, num_keys);
+    cout << "   Bamboo         :: insert " << std::setw(6) << ins
+        << " M/s :: count- " << std::setw(6) << look << " M/s" << endl;
+    sink += hits;
+    delete bbf;
+
+    int max_shards = std::max(8u, std::thread::hardware_concurrency());
+    for (int shards = 1; shards <= max_shards; shards *= 2) {
+        ShardedBamboo *sbf = new ShardedBamboo(shards, bucket_idx_len, 
+            fgpt_size, fgpt_per_bucket, seg_idx_base, 1, 2);
+        t1 = std::chrono::high_resolution_clock::now();
+        for (u64 i = 0; i < num_keys; i += chunk)
+            sbf->insert_batch(&keys[i], std::min<u64>(chunk, num_keys - i));
+        ins = mops(t1, num_keys);
+
+        hits = 0;
+        t1 = std::chrono::high_resolution_clock::now();
+        for (u64 i = 0; i < num_keys; i += chunk) {
+            size_t n = std::min<u64>(chunk, num_keys - i);
+            sbf->count_batch(&negatives[i], n, counts.data());
+            for (size_t j = 0; j < n; ++j)
+                hits += counts[j];
+        }
+        look = mops(t1, num_keys);
+
+        u64 missing = 0;
+        for (u64 i = 0; i < num_keys; i += chunk) {
+            size_t n = std::min<u64>(chunk, num_keys - i);
+            sbf->count_batch(&keys[i], n, counts.data());
+            for (size_t j = 0; j < n; ++j)
+                missing += !counts[j];
+        }
+        cout << "   Sharded " << std::setw(2) << shards 
+            << "     :: insert " << std::setw(6) << ins
+            << " M/s :: count- " << std::setw(6) << look << " M/s"
+            << " :: load " << (double) sbf->occupancy() / sbf->capacity();
+        if (missing)
+            cout << " ** " << missing << " false negatives **";
+        cout << endl;
+        sink += hits;
+        delete sbf;
+    }
+}
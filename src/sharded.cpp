@@ -0,0 +1,151 @@
+#include "include/sharded.hpp"
+
+/* Sharded Bamboo */
+
+
+ShardedBamboo::ShardedBamboo(int num_shards, int bucket_idx_len, 
+        int fgpt_size, int fgpt_per_bucket, int seg_idx_base, u32 seed, 
+        u32 alt_seed) :
+            _stop(false),
+            _failed(false)
+{
+    if (num_shards < 1 || (num_shards & (num_shards - 1)))
+        throw std::runtime_error("Number of shards must be a power of two");
+    int shard_bits = __builtin_ctz(num_shards);
+    if (shard_bits + bucket_idx_len + seg_idx_base + fgpt_size > 64)
+        throw std::runtime_error("Shard bits overlap the hash bits of a shard");
+    _shard_shift = 64 - shard_bits;
+
+    /* The same seeds everywhere, so that any shard hashes for all */
+    for (int i = 0; i < num_shards; ++i) {
+        Shard *shard = new Shard();
+        shard->filter = make_bamboo(bucket_idx_len, fgpt_size, 
+            fgpt_per_bucket, seg_idx_base, 0, seed, alt_seed);
+        _shards.push_back(shard);
+    }
+    for (Shard *shard : _shards)
+        shard->worker = std::thread(&ShardedBamboo::_run, this, shard);
+}
+
+
+ShardedBamboo::~ShardedBamboo()
+{
+    _stop = true;
+    for (Shard *shard : _shards) {
+        shard->worker.join();
+        delete shard->filter;
+        delete shard;
+    }
+}
+
+
+void ShardedBamboo::_push(Shard *shard, u64 hash, u32 *result, u32 op)
+{
+    ShardQueue &q = shard->queue;
+    u32 tail = q.tail.load(std::memory_order_relaxed);
+    while (tail - q.head.load(std::memory_order_acquire) == ShardQueue::SIZE)
+        std::this_thread::yield();
+    q.ops[tail & (ShardQueue::SIZE - 1)] = {hash, result, op};
+    q.tail.store(tail + 1, std::memory_order_release);
+    ++shard->submitted;
+}
+
+
+/* Worker of *shard*: drains whatever is queued, then publishes how far 
+ * it got */
+void ShardedBamboo::_run(Shard *shard)
+{
+    ShardQueue &q = shard->queue;
+    Bamboo *filter = shard->filter;
+    u32 head = q.head.load(std::memory_order_relaxed);
+    int idle = 0;
+    for (;;) {
+        u32 tail = q.tail.load(std::memory_order_acquire);
+        if (head == tail) {
+            if (_stop)
+                return;
+            /* Spin briefly, then back off so idle shards cost little */
+            if (++idle > 4096)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            else if (idle > 64)
+                std::this_thread::yield();
+            continue;
+        }
+        idle = 0;
+        u32 n = tail - head;
+        try {
+            for (; head != tail; ++head) {
+                ShardOp &op = q.ops[head & (ShardQueue::SIZE - 1)];
+                if (op.op == OP_COUNT)
+                    *op.result = filter->count_hash(op.hash);
+                else if (op.op == OP_INSERT)
+                    filter->insert_hash(op.hash);
+                else
+                    filter->remove_hash(op.hash);
+            }
+        } catch (std::exception &e) {
+            /* Skip the rest of the run, flush() reports the first error */
+            if (!_failed.exchange(true))
+                _error = e.what();
+            head = tail;
+        }
+        q.head.store(head, std::memory_order_release);
+        shard->completed.store(shard->completed.load(
+            std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+}
+
+
+void ShardedBamboo::flush()
+{
+    for (Shard *shard : _shards) {
+        while (shard->completed.load(std::memory_order_acquire) 
+                != shard->submitted)
+            std::this_thread::yield();
+    }
+    if (_failed.exchange(false))
+        throw std::runtime_error(_error);
+}
+
+
+int ShardedBamboo::count(u64 key)
+{
+    u32 result;
+    count(key, &result);
+    flush();
+    return result;
+}
+
+
+void ShardedBamboo::insert_batch(const u64 *keys, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        insert(keys[i]);
+    flush();
+}
+
+
+void ShardedBamboo::count_batch(const u64 *keys, size_t n, u32 *counts)
+{
+    for (size_t i = 0; i < n; ++i)
+        count(keys[i], &counts[i]);
+    flush();
+}
+
+
+u64 ShardedBamboo::occupancy()
+{
+    u64 occ = 0;
+    for (Shard *shard : _shards)
+        occ += shard->filter->occupancy();
+    return occ;
+}
+
+
+u64 ShardedBamboo::capacity()
+{
+    u64 cap = 0;
+    for (Shard *shard : _shards)
+        cap += shard->filter->capacity();
+    return cap;
+}
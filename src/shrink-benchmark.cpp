@@ -0,0 +1,100 @@
+#include "include/bamboo.hpp"
+#include "include/memory.hpp"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using std::cout, std::endl;
+
+/* Memory given back by Bamboo::shrink() after a delete-heavy phase: fills
+ * a filter, removes most of the keys, then merges segments, explicitly or
+ * through the *_shrink_load* low-water trigger. RSS is process-wide and 
+ * counted from before the filter is built. glibc keeps small freed blocks
+ * such as segment slabs in its heap, so they are trimmed before each 
+ * reading */
+
+void trim()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+void report(const char *step, Bamboo &bbf, size_t base_rss)
+{
+    trim();
+    cout << std::setw(14) << step
+        << " :: segments " << std::setw(6) << bbf._num_segments
+        << " :: global depth " << std::setw(2) << bbf._global_depth
+        << " :: load " << std::setw(6) 
+        << (double) bbf.occupancy() / bbf.capacity()
+        << " :: RSS " << std::setw(8) 
+        << ((long long) getCurrentRSS() - (long long) base_rss) / 1024 
+        << " KiB" << endl;
+}
+
+
+void bench_shrink(vector<int> &keys, double keep, bool automatic)
+{
+    int num_elements = keys.size();
+    trim();
+    size_t base_rss = getCurrentRSS();
+    int bucket_idx_len = 8;
+    int fgpt_size = 15;
+    int fgpt_per_bucket = 8;
+    int seg_idx_base = 4;
+    Bamboo bbf(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base);
+    if (automatic)
+        bbf._shrink_load = 0.2;
+
+    cout << (automatic ? "automatic" : "shrink()") << " :: items " 
+        << num_elements << " :: keep " << keep << endl;
+    for (int k : keys)
+        bbf.insert(k);
+    report("filled", bbf, base_rss);
+
+    int kept = (int) (keep * num_elements);
+    for (int i = kept; i < num_elements; ++i)
+        bbf.remove(keys[i]);
+    report("removed", bbf, base_rss);
+
+    if (!automatic) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        int merges = bbf.shrink();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        report("shrunk", bbf, base_rss);
+        cout << "    " << merges << " merges in " 
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                t2 - t1).count() << " us" << endl;
+    }
+
+    int missing = 0;
+    for (int i = 0; i < kept; ++i)
+        missing += !bbf.count(keys[i]);
+    if (missing)
+        cout << "** " << missing << " false negatives **" << endl;
+
+    /* Filling up again splits the merged segments */
+    for (int i = kept; i < num_elements; ++i)
+        bbf.insert(keys[i]);
+    report("refilled", bbf, base_rss);
+}
+
+
+int main()
+{
+    std::mt19937 gen(0);
+    vector<int> keys(4000000);
+    for (int &k : keys)
+        k = gen();
+
+    cout << std::setprecision(3) << std::fixed;
+    for (bool automatic : {false, true}) {
+        bench_shrink(keys, 0.1, automatic);
+        bench_shrink(keys, 0.02, automatic);
+    }
+}
@@ -0,0 +1,97 @@
+#include "include/bamboo.hpp"
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <unordered_set>
+
+using std::cout, std::endl;
+
+/* Effect of the per-segment stash (BambooBase::_stash_size) on how full
+ * segments get before they expand. For Bamboo: the load at the first
+ * split, the number of splits and the load after inserting all keys. 
+ * BambooOverflow splits on a schedule instead, so for it the number of
+ * overflow segments counts. With insert throughput and the FPR. */
+
+volatile u64 sink;
+
+void bench_stash(const char *name, BambooBase *bbf, u32 stash_size,
+        vector<int> &keys, vector<int> &negatives)
+{
+    bbf->_stash_size = stash_size;
+    bbf->_chain_max = 100;
+
+    double first_split_load = 0;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int key : keys) {
+        if (!bbf->stats._expand_count)
+            first_split_load = (double) bbf->occupancy() / bbf->capacity();
+        bbf->insert(key);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    double secs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t2 - t1).count() / 1e9;
+
+    int overflows = 0;
+    if (BambooOverflow *bof = dynamic_cast<BambooOverflow*>(bbf)) {
+        for (Segment *segment : bof->_segments)
+            for (Segment *s = segment->overflow; s; s = s->overflow)
+                ++overflows;
+    }
+
+    int missing = 0;
+    for (int key : keys)
+        missing += !bbf->count(key);
+    u64 fp = 0;
+    for (int key : negatives)
+        fp += bbf->count(key) > 0;
+
+    cout << std::setw(9) << name
+        << " stash " << stash_size
+        << " :: insert " << std::setw(6) << keys.size() / secs / 1e6 << " M/s"
+        << " :: first split at load " << first_split_load
+        << " :: expansions " << std::setw(5) << bbf->stats._expand_count
+        << " :: overflow segments " << std::setw(3) << overflows
+        << " :: load " << (double) bbf->occupancy() / bbf->capacity()
+        << " :: FPR " << std::setprecision(5) 
+        << (double) fp / negatives.size() << std::setprecision(3);
+    if (missing)
+        cout << " ** " << missing << " false negatives **";
+    cout << endl;
+    sink += fp;
+    delete bbf;
+}
+
+
+int main()
+{
+    int num_elements = 1000000;
+    int num_negatives = 1000000;
+    std::mt19937 gen(0);
+    std::unordered_set<int> seen;
+    vector<int> keys, negatives;
+    while ((int) keys.size() < num_elements) {
+        int key = gen();
+        if (seen.insert(key).second)
+            keys.push_back(key);
+    }
+    while ((int) negatives.size() < num_negatives) {
+        int key = gen();
+        if (!seen.count(key))
+            negatives.push_back(key);
+    }
+
+    cout << std::setprecision(3) << std::fixed;
+    for (int fgpt_per_bucket : {2, 4, 8}) {
+        cout << "fgpt_size 15 slots " << fgpt_per_bucket << " chain_max 100" 
+            << endl;
+        for (u32 stash_size : {0, 2, 4, 8})
+            bench_stash("bamboo", make_bamboo(8, 15, fgpt_per_bucket, 4, 
+                0, 1, 2), stash_size, keys, negatives);
+        /* BambooOverflow is slow to fill, see reserve() */
+        vector<int> sub(keys.begin(), keys.begin() + num_elements / 10);
+        for (u32 stash_size : {0, 4, 8})
+            bench_stash("overflow", new BambooOverflow(8, 15, 
+                fgpt_per_bucket, 4), stash_size, sub, negatives);
+    }
+}
@@ -8,6 +8,7 @@ CountingBamboo init_cbbf_larger();
 void counting_tests_simple();
 void counting_tests_simple_larger();
 void counting_tests_fill();
+void counting_tests_insert_batch();
 
 /* Wrap the tests in try - catch statements */
 int main()
@@ -27,6 +28,9 @@ int main()
     srand(seed);
     counting_tests_fill();
 
+    srand(seed);
+    counting_tests_insert_batch();
+
 
     cout <<  "\n======\nTests Complete\n======\n" << endl;
 }
@@ -165,4 +169,35 @@ CountingBamboo init_cbbf_larger()
     int fgpt_per_bucket = 8;
     int seg_idx_base = 4;
     return CountingBamboo(bucket_idx_len, fgpt_size, fgpt_per_bucket, seg_idx_base);
-}
\ No newline at end of file
+}
+
+
+void counting_tests_insert_batch()
+{
+    cout << "\n ++++ Begin counting bamboo insert batch test ++++ \n" << endl;
+
+    int m = 1000000;
+    vector<int> keys(m);
+    for (int i = 0; i < m; ++i)
+        keys[i] = i % 100000 ? rand() : 7;
+
+    CountingBamboo seq(8, 15, 8, 4, 1, 2);
+    CountingBamboo bat(8, 15, 8, 4, 1, 2);
+    size_t inserted = 0;
+    try {
+        for (int key : keys)
+            seq.insert(key);
+        for (int i = 0; i < m; i += 100000)
+            inserted += bat.insert_batch(&keys[i], 100000);
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+
+    int diff = 0;
+    for (int key : keys)
+        diff += seq.count(key) != bat.count(key) 
+            || seq.count(key + 1) != bat.count(key + 1);
+    cout << "Inserted: " << inserted << " :: Occupancy: " << seq.occupancy()
+        << " / " << bat.occupancy() << " :: differing counts: " << diff 
+        << endl;
+}
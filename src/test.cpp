@@ -1,4 +1,5 @@
 #include "include/bamboo.hpp"
+#include "include/interleave.hpp"
 #include <iostream>
 
 using std::cout, std::endl;
@@ -14,6 +15,17 @@ void bamboo_tests_cuckoo();
 void bamboo_tests_fill();
 void bamboo_tests_larger_simple();
 void bamboo_tests_larger_fill();
+void bamboo_tests_key_types();
+void bamboo_tests_reserve();
+void bamboo_tests_shrink();
+void bamboo_tests_bfs();
+void bamboo_tests_seeded();
+void bamboo_tests_stash();
+void bamboo_tests_build();
+void bamboo_tests_batch();
+void bamboo_tests_insert_batch();
+void bamboo_tests_interleaved();
+void bamboo_tests_contains();
 void cbamboo_tests_default_count();
 void cbamboo_tests_larger_count();
 void cbamboo_test_default_count_2();
@@ -40,6 +52,27 @@ int main()
     // bamboo_tests_fill();
     // srand(seed);
     // bamboo_tests_larger_fill();
+    srand(seed);
+    bamboo_tests_key_types();
+    srand(seed);
+    bamboo_tests_reserve();
+    srand(seed);
+    bamboo_tests_shrink();
+    srand(seed);
+    bamboo_tests_bfs();
+    bamboo_tests_seeded();
+    srand(seed);
+    bamboo_tests_stash();
+    srand(seed);
+    bamboo_tests_build();
+    srand(seed);
+    bamboo_tests_batch();
+    srand(seed);
+    bamboo_tests_insert_batch();
+    srand(seed);
+    bamboo_tests_interleaved();
+    srand(seed);
+    bamboo_tests_contains();
 
     // srand(seed);
     // cbamboo_tests_default_count();
@@ -127,8 +160,8 @@ void bamboo_tests_cuckoo()
         /* fill both buckets */
         u8 alt_fgpt = fgpt ^ 2;
         for (int i=0; i<2*bbf._fgpt_per_bucket; ++i) {
-            seg->buckets[bidx1].insert_fgpt_at(i, alt_fgpt);
-            seg->buckets[bidx2].insert_fgpt_at(i, alt_fgpt);
+            seg->bucket(bidx1).insert_fgpt_at(i, alt_fgpt);
+            seg->bucket(bidx2).insert_fgpt_at(i, alt_fgpt);
         }
 
         for (int i=0; i< 5* bbf._fgpt_per_bucket + 1; ++i) {
@@ -245,6 +278,429 @@ void bamboo_tests_larger_fill()
 }
 
 
+/* Inserts u64, string and pre-hashed keys next to int keys, then checks
+ * that every one of them is found and can be removed. */
+void bamboo_tests_key_types()
+{
+    cout << "\n ++++ Begin bamboo key types test ++++ \n" << endl;
+
+    Bamboo bbf = init_bbf_larger();
+    int m = 100000;
+    u64 big = (u64) 1 << 40;
+    SpookyHash h;
+    vector<std::string> strs;
+    for (int i = 0; i < m; ++i)
+        strs.push_back("key-" + std::to_string(i));
+
+    try {
+        for (int i = 0; i < m; ++i) {
+            bbf.insert(i);
+            bbf.insert(big + i);
+            bbf.insert(std::string_view(strs[i]));
+            bbf.insert_hash(h.Hash64(&i, 4, 1234));
+        }
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+    cout << "Occupancy: " << bbf.occupancy() << "/" << bbf.capacity() << endl;
+
+    int missing = 0;
+    for (int i = 0; i < m; ++i) {
+        missing += !bbf.count(i) + !bbf.count(big + i) 
+            + !bbf.count(std::string_view(strs[i]))
+            + !bbf.contains_hash(h.Hash64(&i, 4, 1234));
+    }
+    cout << "False negatives: " << missing << endl;
+
+    int failed = 0;
+    for (int i = 0; i < m; ++i) {
+        failed += !bbf.remove(i) + !bbf.remove(big + i) 
+            + !bbf.remove(std::string_view(strs[i]))
+            + !bbf.remove_hash(h.Hash64(&i, 4, 1234));
+    }
+    cout << "Failed removes: " << failed 
+        << " :: Occupancy after removes: " << bbf.occupancy() << endl;
+
+    /* Narrow integer types are int keys, wide ones u64 keys */
+    bbf.insert((unsigned) 7);
+    bbf.insert((short) 8);
+    bbf.insert(big + 9ll);
+    int mismatched = (bbf.count(7l) != bbf.count((u64) 7))
+        + (bbf.count((unsigned) 7) != bbf.count(7)) + !bbf.count((u16) 8)
+        + (bbf.count(big + 9ull) != bbf.count(big + 9));
+    cout << "Mismatched integer key types: " << mismatched << endl;
+}
+
+
+void bamboo_tests_reserve()
+{
+    cout << "\n ++++ Begin bamboo reserve test ++++ \n" << endl;
+
+    Bamboo bbf = init_bbf_larger();
+    BambooOverflow obbf(8, 15, 8, 4);
+    int m = 400000;
+
+    /* Reserving with items present splits them along */
+    try {
+        for (int i = 0; i < m / 4; ++i) {
+            bbf.insert(i);
+            obbf.insert(i);
+        }
+        int expansions = bbf.stats._expand_count;
+        bbf.reserve(m);
+        obbf.reserve(m);
+        cout << "Segments after reserve: " << bbf._num_segments 
+            << " :: overflow segments: " << obbf._segments.size() << endl;
+        for (int i = m / 4; i < m; ++i) {
+            bbf.insert(i);
+            obbf.insert(i);
+        }
+        cout << "Expansions after reserve: " 
+            << bbf.stats._expand_count - expansions << endl;
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+    cout << "Occupancy: " << bbf.occupancy() << "/" << bbf.capacity() 
+        << " :: overflow: " << obbf.occupancy() << "/" << obbf.capacity() 
+        << endl;
+
+    int missing = 0;
+    for (int i = 0; i < m; ++i)
+        missing += !bbf.count(i) + !obbf.count(i);
+    cout << "False negatives: " << missing << endl;
+}
+
+
+void bamboo_tests_shrink()
+{
+    cout << "\n ++++ Begin bamboo shrink test ++++ \n" << endl;
+
+    Bamboo bbf = init_bbf_larger();
+    int m = 400000;
+    int kept = m / 20;
+
+    try {
+        for (int i = 0; i < m; ++i)
+            bbf.insert(i);
+        cout << "Segments filled: " << bbf._num_segments << endl;
+        for (int i = kept; i < m; ++i)
+            bbf.remove(i);
+        int merges = bbf.shrink();
+        cout << "Merges: " << merges << " :: segments shrunk: " 
+            << bbf._num_segments << " :: global depth: " 
+            << bbf._global_depth << endl;
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+    cout << "Occupancy: " << bbf.occupancy() << "/" << bbf.capacity() << endl;
+
+    int missing = 0;
+    for (int i = 0; i < kept; ++i)
+        missing += !bbf.count(i);
+    cout << "False negatives: " << missing << endl;
+}
+
+
+void bamboo_tests_bfs()
+{
+    cout << "\n ++++ Begin bamboo bfs cuckoo test ++++ \n" << endl;
+
+    Bamboo bbf = init_bbf_larger();
+    bbf._bfs_cuckoo = true;
+    int m = 400000;
+
+    try {
+        /* Every key twice, to move entries holding two copies */
+        for (int i = 0; i < m; ++i)
+            bbf.insert(i / 2);
+        for (int i = 0; i < m / 2; i += 2)
+            bbf.remove(i);
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+    cout << "Occupancy: " << bbf.occupancy() << "/" << bbf.capacity() 
+        << " :: moves: " << bbf.stats._counter0 << endl;
+
+    int missing = 0;
+    for (int i = 0; i < m / 2; ++i)
+        missing += bbf.count(i) < 2 - (i % 2 == 0);
+    cout << "False negatives: " << missing << endl;
+}
+
+
+/* Two filters with the same explicit seeds must evict identically, however
+ * the inserts interleave and whatever else calls rand() */
+void bamboo_tests_seeded()
+{
+    cout << "\n ++++ Begin bamboo seeded test ++++ \n" << endl;
+
+    Bamboo *a = make_bamboo(8, 15, 4, 4, 0, 1234, 5678);
+    Bamboo *b = make_bamboo(8, 15, 4, 4, 0, 1234, 5678);
+    int m = 200000;
+    for (int i = 0; i < m; ++i) {
+        a->insert(i);
+        rand();
+    }
+    for (int i = 0; i < m; ++i)
+        b->insert(i);
+
+    int diff = 0;
+    for (int i = 0; i < m; ++i)
+        diff += a->count(i) != b->count(i);
+    cout << "Evictions: " << a->stats._counter0 << " / " 
+        << b->stats._counter0 << " :: segments: " << a->_num_segments
+        << " / " << b->_num_segments << " :: differing counts: " << diff
+        << endl;
+    delete a;
+    delete b;
+}
+
+
+void bamboo_tests_stash()
+{
+    cout << "\n ++++ Begin bamboo stash test ++++ \n" << endl;
+
+    for (bool lazy : {false, true}) {
+        Bamboo bbf(8, 15, 4, 4);
+        bbf._stash_size = Segment::STASH_MAX;
+        bbf._chain_max = 20;
+        bbf._lazy_split = lazy;
+        int m = 400000;
+        int stashed = 0;
+
+        try {
+            for (int i = 0; i < m; ++i)
+                bbf.insert(i);
+            bbf.for_each_segment([&](Segment *segment, u32) {
+                stashed += segment->_stash_len;
+            });
+            for (int i = 0; i < m; ++i)
+                if (i % 4)
+                    bbf.remove(i);
+            bbf.shrink();
+        } catch (std::exception& e) {
+            cout << "bucket full or something, error:" << e.what() << endl;
+        }
+        int missing = 0;
+        for (int i = 0; i < m; i += 4)
+            missing += !bbf.count(i);
+        cout << (lazy ? "Lazy splits" : "Eager splits") << " :: stashed: " 
+            << stashed << " :: splits: " << bbf.stats._expand_count 
+            << " :: segments after shrink: " << bbf._num_segments
+            << " :: false negatives: " << missing << endl;
+    }
+}
+
+
+/* A built filter must answer every count like one filled by insert() */
+void bamboo_tests_build()
+{
+    cout << "\n ++++ Begin bamboo build test ++++ \n" << endl;
+
+    int m = 1000000;
+    vector<u64> keys(m);
+    for (int i = 0; i < m; ++i)
+        keys[i] = (u64) rand() << 32 | (i % 100 ? rand() : 7);
+
+    Bamboo *seq = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+    Bamboo *par = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+    try {
+        for (u64 key : keys)
+            seq->insert(key);
+        par->build(keys.data(), m, 4);
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+
+    int diff = 0;
+    for (int i = 0; i < m; ++i) {
+        diff += seq->count(keys[i]) != par->count(keys[i]);
+        diff += seq->count(keys[i] + 1) != par->count(keys[i] + 1);
+    }
+    cout << "Segments: " << seq->_num_segments << " / " << par->_num_segments
+        << " :: occupancy: " << seq->occupancy() << " / " << par->occupancy()
+        << " :: differing counts: " << diff << endl;
+    delete seq;
+    delete par;
+}
+
+
+void bamboo_tests_batch()
+{
+    cout << "\n ++++ Begin bamboo batch lookup test ++++ \n" << endl;
+
+    int m = 200000;
+    vector<int> keys(2 * m);
+    vector<u64> keys64(2 * m);
+    for (int i = 0; i < 2 * m; ++i) {
+        keys[i] = rand();
+        keys64[i] = (u64) rand() << 32 | rand();
+    }
+
+    /* A packed filter and one in the middle of lazy splits as well */
+    for (int variant = 0; variant < 3; ++variant) {
+        Bamboo *bbf = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+        bbf->_lazy_split = variant == 2;
+        try {
+            for (int i = 0; i < m; ++i) {
+                bbf->insert(keys[i]);
+                bbf->insert(keys64[i]);
+            }
+        } catch (std::exception& e) {
+            cout << "bucket full or something, error:" << e.what() << endl;
+        }
+        if (variant == 1)
+            bbf->pack();
+
+        vector<u32> counts(2 * m);
+        bool *found = new bool[2 * m];
+        int diff = 0;
+        bbf->count_batch(keys.data(), 2 * m, counts.data());
+        bbf->contains_batch(keys.data(), 2 * m, found);
+        for (int i = 0; i < 2 * m; ++i)
+            diff += counts[i] != (u32) bbf->count(keys[i])
+                || found[i] != (counts[i] > 0);
+        bbf->count_batch(keys64.data(), 2 * m, counts.data());
+        bbf->contains_batch(keys64.data(), 2 * m, found);
+        for (int i = 0; i < 2 * m; ++i)
+            diff += counts[i] != (u32) bbf->count(keys64[i])
+                || found[i] != (counts[i] > 0);
+        cout << (variant == 1 ? "packed" : variant == 2 ? "lazy  " : "plain ")
+            << " :: differing counts: " << diff << endl;
+        delete[] found;
+        delete bbf;
+    }
+}
+
+
+void bamboo_tests_insert_batch()
+{
+    cout << "\n ++++ Begin bamboo insert batch test ++++ \n" << endl;
+
+    int m = 1000000;
+    vector<int> keys(m);
+    vector<u64> keys64(m);
+    for (int i = 0; i < m; ++i) {
+        keys[i] = i % 100000 ? rand() : 7;
+        keys64[i] = (u64) rand() << 32 | rand();
+    }
+
+    /* Batches split segments on the way, lazily in the second round */
+    for (bool lazy : {false, true}) {
+        Bamboo *seq = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+        Bamboo *bat = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+        seq->_lazy_split = bat->_lazy_split = lazy;
+        size_t inserted = 0;
+        try {
+            for (int i = 0; i < m; ++i) {
+                seq->insert(keys[i]);
+                seq->insert(keys64[i]);
+            }
+            for (int i = 0; i < m; i += 100000) {
+                inserted += bat->insert_batch(&keys[i], 100000);
+                inserted += bat->insert_batch(&keys64[i], 100000);
+            }
+        } catch (std::exception& e) {
+            cout << "bucket full or something, error:" << e.what() << endl;
+        }
+
+        int diff = 0;
+        for (int i = 0; i < m; ++i) {
+            diff += seq->count(keys[i]) != bat->count(keys[i]);
+            diff += seq->count(keys64[i]) != bat->count(keys64[i]);
+            diff += seq->count(keys64[i] + 1) != bat->count(keys64[i] + 1);
+        }
+        cout << (lazy ? "lazy  " : "eager ") << " :: inserted: " << inserted
+            << " :: occupancy: " << seq->occupancy() << " / " 
+            << bat->occupancy() << " :: differing counts: " << diff << endl;
+        delete seq;
+        delete bat;
+    }
+}
+
+
+/* Only with C++20 coroutines, see interleave.hpp */
+void bamboo_tests_interleaved()
+{
+#if defined(__cpp_impl_coroutine)
+    cout << "\n ++++ Begin bamboo interleaved lookup test ++++ \n" << endl;
+
+    int m = 200000;
+    vector<int> keys(2 * m);
+    for (int i = 0; i < 2 * m; ++i)
+        keys[i] = rand();
+
+    Bamboo *bbf = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+    try {
+        for (int i = 0; i < m; ++i)
+            bbf->insert(keys[i]);
+    } catch (std::exception& e) {
+        cout << "bucket full or something, error:" << e.what() << endl;
+    }
+    vector<u32> counts(2 * m);
+    for (int group : {1, 3, 16}) {
+        int diff = 0;
+        count_interleaved(bbf, keys.data(), 2 * m, counts.data(), group);
+        for (int i = 0; i < 2 * m; ++i)
+            diff += counts[i] != (u32) bbf->count(keys[i]);
+        cout << "group " << group << " :: differing counts: " << diff << endl;
+    }
+    delete bbf;
+#endif
+}
+
+
+void bamboo_tests_contains()
+{
+    cout << "\n ++++ Begin bamboo contains test ++++ \n" << endl;
+
+    int m = 100000;
+    vector<int> keys(2 * m);
+    for (int i = 0; i < 2 * m; ++i)
+        keys[i] = rand();
+
+    /* Fixed and runtime buckets, with a stash, packed, in the middle of
+     * lazy splits, and overflow chains */
+    const char *names[] = {"fixed", "stash", "packed", "lazy", "runtime",
+        "overflow"};
+    for (int variant = 0; variant < 6; ++variant) {
+        BambooBase *bbf;
+        if (variant == 4)
+            bbf = new Bamboo(8, 15, 4, 4, 1, 2);
+        else if (variant == 5)
+            bbf = new BambooOverflow(8, 15, 4, 4);
+        else
+            bbf = make_bamboo(8, 15, 4, 4, 0, 1, 2);
+        if (variant == 1) {
+            bbf->_stash_size = 4;
+            bbf->_chain_max = 20;
+        }
+        if (variant == 3)
+            ((Bamboo *) bbf)->_lazy_split = true;
+        try {
+            for (int i = 0; i < m; ++i)
+                bbf->insert(keys[i]);
+        } catch (std::exception& e) {
+            cout << "bucket full or something, error:" << e.what() << endl;
+        }
+        if (variant == 2)
+            ((Bamboo *) bbf)->pack();
+
+        int diff = 0, missing = 0;
+        for (int i = 0; i < 2 * m; ++i) {
+            bool found = bbf->contains(keys[i]);
+            diff += found != (bbf->count(keys[i]) > 0);
+            diff += bbf->contains((u64) keys[i]) 
+                != (bbf->count((u64) keys[i]) > 0);
+            missing += i < m && !found;
+        }
+        cout << names[variant] << " :: false negatives: " << missing
+            << " :: differing answers: " << diff << endl;
+        delete bbf;
+    }
+}
+
+
 /* Counting Bamboo tests */
 
 